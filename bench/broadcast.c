@@ -0,0 +1,143 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#define _GNU_SOURCE // clock_gettime, F_SETPIPE_SZ
+#include "msgstream/broadcast.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Compare the time to publish one message to many pipe subscribers with
+ * msgstream_broadcast_publish against calling msgstream_fd_send for each.
+ *
+ *   broadcast [msg_size]
+ *
+ * Subscriber pipes are drained between publishes, outside the timed section.
+ */
+
+#define DEFAULT_MSG_SIZE (32u << 10)
+#define PIPE_SIZE (1 << 20)
+#define ITERS 200
+#define MAX_SUBS 256
+
+static int rd[MAX_SUBS], wr[MAX_SUBS];
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void drain(size_t nsubs) {
+  static char buf[1 << 16];
+  for (size_t i = 0; i < nsubs; ++i)
+    while (read(rd[i], buf, sizeof(buf)) > 0)
+      ;
+}
+
+static int bench_publish(size_t nsubs, const void *msg, size_t msg_size,
+                         double *usec) {
+  msgstream_broadcast bc =
+      msgstream_broadcast_alloc(msg_size, MSGSTREAM_BROADCAST_DISCONNECT);
+  if (!bc)
+    return MSGSTREAM_ALLOC;
+
+  int ec = MSGSTREAM_OK;
+  for (size_t i = 0; !ec && i < nsubs; ++i)
+    ec = msgstream_broadcast_add(bc, wr[i]);
+
+  double total = 0;
+  for (int n = 0; !ec && n < ITERS; ++n) {
+    double start = now_sec();
+    ec = msgstream_broadcast_publish(bc, msg, msg_size);
+    total += now_sec() - start;
+
+    int fd;
+    if (msgstream_broadcast_next_disconnected(bc, &fd))
+      ec = MSGSTREAM_SYS_WRITE_ERR;
+
+    drain(nsubs);
+  }
+
+  msgstream_broadcast_free(bc);
+  *usec = total / ITERS * 1e6;
+  return ec;
+}
+
+static int bench_send(size_t nsubs, const void *msg, size_t msg_size,
+                      double *usec) {
+  int ec = MSGSTREAM_OK;
+  double total = 0;
+  for (int n = 0; !ec && n < ITERS; ++n) {
+    double start = now_sec();
+    for (size_t i = 0; !ec && i < nsubs; ++i)
+      ec = msgstream_fd_send(wr[i], msg, msg_size, msg_size);
+    total += now_sec() - start;
+
+    drain(nsubs);
+  }
+
+  *usec = total / ITERS * 1e6;
+  return ec;
+}
+
+int main(int argc, char **argv) {
+  size_t msg_size = DEFAULT_MSG_SIZE;
+  if (argc == 2) {
+    msg_size = strtoul(argv[1], NULL, 10);
+  } else if (argc != 1) {
+    fprintf(stderr, "usage: %s [msg_size]\n", argv[0]);
+    return 1;
+  }
+
+  for (size_t i = 0; i < MAX_SUBS; ++i) {
+    int fds[2];
+    if (pipe(fds) == -1) {
+      perror("pipe");
+      return 1;
+    }
+
+    rd[i] = fds[0];
+    wr[i] = fds[1];
+    fcntl(rd[i], F_SETFL, O_NONBLOCK);
+    fcntl(wr[i], F_SETFL, O_NONBLOCK);
+#ifdef F_SETPIPE_SZ
+    fcntl(wr[i], F_SETPIPE_SZ, PIPE_SIZE);
+#endif
+  }
+
+  void *msg = malloc(msg_size ? msg_size : 1);
+  if (!msg)
+    return 1;
+
+  memset(msg, 7, msg_size);
+
+  printf("%zu byte messages, %d publishes each\n", msg_size, ITERS);
+  printf("%11s %14s %14s\n", "subscribers", "publish (us)", "fd_send (us)");
+  for (size_t nsubs = 1; nsubs <= MAX_SUBS; nsubs *= 4) {
+    double pub, send;
+    int ec = bench_publish(nsubs, msg, msg_size, &pub);
+    if (!ec)
+      ec = bench_send(nsubs, msg, msg_size, &send);
+
+    if (ec) {
+      fprintf(stderr, "%zu subscribers: %s\n", nsubs, msgstream_errstr(ec));
+      free(msg);
+      return 1;
+    }
+
+    printf("%11zu %14.1f %14.1f\n", nsubs, pub, send);
+  }
+
+  free(msg);
+  return 0;
+}
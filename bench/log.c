@@ -0,0 +1,133 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#define _GNU_SOURCE // clock_gettime
+#include "msgstream/log.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Measure durable msgstream_log_append throughput as appending threads are
+ * added, to show how group commit amortizes each sync.
+ *
+ *   log [dir]
+ *
+ * The log and index are created in dir (default ".") and removed afterward.
+ * Use a directory on the filesystem you care about. tmpfs makes syncs free.
+ */
+
+#define MSG_SIZE 100
+#define APPENDS_PER_RUN 8192
+#define MAX_THREADS 64
+
+struct worker {
+  pthread_t th;
+  msgstream_log log;
+  size_t nappends;
+  int ec;
+};
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *append_loop(void *arg) {
+  struct worker *w = arg;
+  uint8_t msg[MSG_SIZE];
+  memset(msg, 7, sizeof(msg));
+
+  uint64_t ordinal;
+  for (size_t i = 0; !w->ec && i < w->nappends; ++i)
+    w->ec = msgstream_log_append(w->log, msg, sizeof(msg), &ordinal);
+
+  return NULL;
+}
+
+static int run(const char *log_path, const char *index_path, int nthreads,
+               double *rate) {
+  int log_fd = open(log_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  int index_fd = open(index_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (log_fd == -1 || index_fd == -1) {
+    perror("open");
+    return 1;
+  }
+
+  msgstream_log log;
+  int ec = msgstream_log_open(log_fd, index_fd, MSG_SIZE, &log);
+  if (ec) {
+    fprintf(stderr, "msgstream_log_open: %s\n", msgstream_errstr(ec));
+    return 1;
+  }
+
+  struct worker workers[MAX_THREADS];
+  double start = now_sec();
+  for (int t = 0; t < nthreads; ++t) {
+    workers[t].log = log;
+    workers[t].nappends = APPENDS_PER_RUN / nthreads;
+    workers[t].ec = MSGSTREAM_OK;
+    if (pthread_create(&workers[t].th, NULL, append_loop, &workers[t])) {
+      perror("pthread_create");
+      return 1;
+    }
+  }
+
+  for (int t = 0; t < nthreads; ++t) {
+    pthread_join(workers[t].th, NULL);
+    if (workers[t].ec && !ec)
+      ec = workers[t].ec;
+  }
+
+  double elapsed = now_sec() - start;
+  uint64_t count = msgstream_log_count(log);
+  msgstream_log_close(log);
+  close(log_fd);
+  close(index_fd);
+
+  if (ec) {
+    fprintf(stderr, "append failed: %s\n", msgstream_errstr(ec));
+    return 1;
+  }
+
+  *rate = count / elapsed;
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc > 2) {
+    fprintf(stderr, "usage: %s [dir]\n", argv[0]);
+    return 1;
+  }
+
+  const char *dir = argc == 2 ? argv[1] : ".";
+  char log_path[4096], index_path[4096];
+  snprintf(log_path, sizeof(log_path), "%s/msgstream-bench.log", dir);
+  snprintf(index_path, sizeof(index_path), "%s/msgstream-bench.idx", dir);
+
+  printf("%d byte appends, %d per run\n", MSG_SIZE, APPENDS_PER_RUN);
+  printf("%7s %12s\n", "threads", "appends/s");
+
+  int ret = 0;
+  for (int nthreads = 1; nthreads <= MAX_THREADS; nthreads *= 4) {
+    double rate;
+    if ((ret = run(log_path, index_path, nthreads, &rate)))
+      break;
+
+    printf("%7d %12.0f\n", nthreads, rate);
+  }
+
+  unlink(log_path);
+  unlink(index_path);
+  return ret;
+}
@@ -0,0 +1,242 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#define _GNU_SOURCE // clock_gettime, getaddrinfo
+#include "msgstream/zerocopy.h"
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Compare msgstream_zerocopy_send against copying sends across message sizes
+ * to find where zero copy starts to pay off.
+ *
+ *   zerocopy                 sender and sink over loopback TCP
+ *   zerocopy -l <port>       sink only, for a sender on another host
+ *   zerocopy <host> <port>   sender only, to a sink on another host
+ *
+ * Loopback always copies (see the copied column), so the crossover only
+ * shows up across a real NIC.
+ */
+
+// bytes sent for each message size and mode
+#define BYTES_PER_RUN (256u << 20)
+#define MIN_MSG_SIZE 4096
+#define MAX_MSG_SIZE (16u << 20)
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *sink(void *arg) {
+  int fd = *(int *)arg;
+  static char buf[1 << 16];
+  while (read(fd, buf, sizeof(buf)) > 0)
+    ;
+
+  close(fd);
+  return NULL;
+}
+
+static int listen_tcp(const char *port, int *out_port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd == -1)
+    return -1;
+
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  struct sockaddr_in addr = {0};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(port ? INADDR_ANY : INADDR_LOOPBACK);
+  addr.sin_port = htons(port ? atoi(port) : 0);
+
+  socklen_t len = sizeof(addr);
+  if (bind(fd, (struct sockaddr *)&addr, len) || listen(fd, 8) ||
+      getsockname(fd, (struct sockaddr *)&addr, &len)) {
+    close(fd);
+    return -1;
+  }
+
+  *out_port = ntohs(addr.sin_port);
+  return fd;
+}
+
+static int connect_tcp(const char *host, const char *port) {
+  struct addrinfo hints = {0}, *res;
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host, port, &hints, &res))
+    return -1;
+
+  int fd = -1;
+  for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd == -1)
+      continue;
+
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+      break;
+
+    close(fd);
+    fd = -1;
+  }
+
+  freeaddrinfo(res);
+  return fd;
+}
+
+// where each run's connection goes: a remote sink or a loopback listener
+struct target {
+  const char *host;
+  const char *port;
+  int lfd;
+  pthread_t th;
+  int rfd;
+};
+
+// a fresh connection per run, since zero copy notification ids are per socket
+static int open_conn(struct target *t) {
+  int fd = connect_tcp(t->host, t->port);
+  if (fd == -1 || t->lfd == -1)
+    return fd;
+
+  t->rfd = accept(t->lfd, NULL, NULL);
+  if (t->rfd == -1 || pthread_create(&t->th, NULL, sink, &t->rfd)) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+static void close_conn(struct target *t, int fd) {
+  close(fd);
+  if (t->lfd != -1)
+    pthread_join(t->th, NULL);
+}
+
+static int run(struct target *t) {
+  uint8_t *buf = malloc(MAX_MSG_SIZE);
+  if (!buf)
+    return 1;
+
+  memset(buf, 7, MAX_MSG_SIZE);
+
+  printf("%10s %-9s %10s %10s\n", "size", "mode", "MB/s", "copied");
+  for (size_t size = MIN_MSG_SIZE; size <= MAX_MSG_SIZE; size *= 4) {
+    size_t iters = BYTES_PER_RUN / size;
+
+    for (int zero = 0; zero < 2; ++zero) {
+      int fd = open_conn(t);
+      if (fd == -1) {
+        fprintf(stderr, "failed to connect to %s:%s\n", t->host, t->port);
+        free(buf);
+        return 1;
+      }
+
+      // a threshold above every message size always copies
+      msgstream_zerocopy zc =
+          msgstream_zerocopy_alloc(fd, zero ? 0 : SIZE_MAX);
+      if (!zc) {
+        close_conn(t, fd);
+        free(buf);
+        return 1;
+      }
+
+      double start = now_sec();
+      uint64_t ticket = 0;
+      int ec = MSGSTREAM_OK;
+      for (size_t i = 0; !ec && i < iters; ++i)
+        ec = msgstream_zerocopy_send(zc, buf, MAX_MSG_SIZE, size, &ticket);
+
+      if (!ec)
+        ec = msgstream_zerocopy_wait(zc, ticket);
+
+      double elapsed = now_sec() - start;
+      int enabled = msgstream_zerocopy_enabled(zc);
+      uint64_t copied = msgstream_zerocopy_copied(zc);
+      msgstream_zerocopy_free(zc);
+      close_conn(t, fd);
+
+      if (ec) {
+        fprintf(stderr, "send failed: %s\n", msgstream_errstr(ec));
+        free(buf);
+        return 1;
+      }
+
+      printf("%10zu %-9s %10.1f %10llu\n", size,
+             zero && enabled ? "zerocopy" : "copy",
+             iters * size / elapsed / 1e6, (unsigned long long)copied);
+    }
+  }
+
+  free(buf);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc == 3 && strcmp(argv[1], "-l") == 0) {
+    int port;
+    int lfd = listen_tcp(argv[2], &port);
+    if (lfd == -1) {
+      perror("listen");
+      return 1;
+    }
+
+    // one connection per run, until interrupted
+    for (;;) {
+      int fd = accept(lfd, NULL, NULL);
+      if (fd == -1) {
+        perror("accept");
+        return 1;
+      }
+
+      sink(&fd);
+    }
+  }
+
+  struct target t = {0};
+  t.lfd = -1;
+
+  if (argc == 3) {
+    t.host = argv[1];
+    t.port = argv[2];
+    return run(&t);
+  }
+
+  if (argc != 1) {
+    fprintf(stderr, "usage: %s [-l <port> | <host> <port>]\n", argv[0]);
+    return 1;
+  }
+
+  int port;
+  t.lfd = listen_tcp(NULL, &port);
+  if (t.lfd == -1) {
+    perror("listen");
+    return 1;
+  }
+
+  char port_str[16];
+  snprintf(port_str, sizeof(port_str), "%d", port);
+  t.host = "127.0.0.1";
+  t.port = port_str;
+
+  int ret = run(&t);
+  close(t.lfd);
+  return ret;
+}
@@ -22,6 +22,12 @@
  */
 #define MSGSTREAM_HEADER_BUF_SIZE 9
 
+/**
+ * Varint message headers will never need more than this many bytes to be
+ * allocated
+ */
+#define MSGSTREAM_VARINT_HEADER_BUF_SIZE 10
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -79,6 +85,68 @@ MSGSTREAM_API int msgstream_fd_send(int fd, const void *buf, size_t buf_size,
 MSGSTREAM_API int msgstream_fd_recv(int fd, void *buf, size_t buf_size,
                                     size_t *msg_size);
 
+/**
+ * Determine how many bytes a varint message header will be given the message
+ * size.
+ *
+ * Varint headers encode the message size as an unsigned LEB128 integer: 7 bits
+ * per byte, least significant group first, with the high bit of each byte set
+ * when more bytes follow. Unlike msgstream_header_size, the header size does
+ * not depend on the receiver's buffer size, so both ends of a stream need not
+ * agree on one.
+ * @param[in] msg_size The size of the message in bytes
+ * @return The size of the header in bytes
+ */
+MSGSTREAM_API size_t msgstream_varint_header_size(size_t msg_size);
+
+/**
+ * Encode a varint message header into a buffer
+ * @param[in] msg_size The size of the message whose header is being encoded
+ * @param[out] hdr_buf The buffer in which to encode the header
+ * @param[in] hdr_buf_size The size of hdr_buf in bytes
+ * @param[out] hdr_size The number of bytes written to hdr_buf
+ * @return An error code
+ */
+MSGSTREAM_API int msgstream_varint_encode_header(size_t msg_size, void *hdr_buf,
+                                                 size_t hdr_buf_size,
+                                                 size_t *hdr_size);
+
+/**
+ * Decode a varint message header into a message size
+ * @param[in] hdr_buf The buffer holding the header to decode
+ * @param[in] hdr_buf_size The number of bytes available in hdr_buf
+ * @param[out] hdr_size The number of bytes the header occupies in hdr_buf
+ * @param[out] msg_size The size of the message payload for the decoded header
+ * @return An error code. MSGSTREAM_SMALL_HDR if hdr_buf ends before the header
+ * does. MSGSTREAM_HDR_SYNC if the header isn't minimally encoded, i.e. it has
+ * more than one byte and its last byte is zero.
+ */
+MSGSTREAM_API int msgstream_varint_decode_header(const void *hdr_buf,
+                                                 size_t hdr_buf_size,
+                                                 size_t *hdr_size,
+                                                 size_t *msg_size);
+
+/**
+ * Send a message with a varint header over a file descriptor
+ * @param[in] fd The file decriptor to write the message to
+ * @param[in] buf A buffer holding the message to be sent
+ * @param[in] msg_size The size of the message in bytes
+ * @return An error code
+ */
+MSGSTREAM_API int msgstream_fd_varint_send(int fd, const void *buf,
+                                           size_t msg_size);
+
+/**
+ * Receive a message with a varint header over a file descriptor
+ * @param[in] fd The file decriptor to read the message from
+ * @param[in] buf A buffer to hold the received message
+ * @param[in] buf_size The size of the buffer in bytes
+ * @param[out] msg_size The size of the received message
+ * @return An error code. MSGSTREAM_BIG_MSG if the message does not fit in buf.
+ */
+MSGSTREAM_API int msgstream_fd_varint_recv(int fd, void *buf, size_t buf_size,
+                                           size_t *msg_size);
+
 /// @private
 struct msgstream_incremental_reader_;
 
@@ -96,6 +164,15 @@ typedef struct msgstream_incremental_reader_ *msgstream_incremental_reader;
 MSGSTREAM_API msgstream_incremental_reader
 msgstream_incremental_reader_alloc(void *buf, size_t buf_size);
 
+/**
+ * Allocate an incremental reader for messages with varint headers
+ * @param[in] buf The buffer to hold the received message
+ * @param[in] buf_size The size of the buffer in bytes
+ * @return The allocated opaque incremental reader, or NULL
+ */
+MSGSTREAM_API msgstream_incremental_reader
+msgstream_varint_incremental_reader_alloc(void *buf, size_t buf_size);
+
 /**
  * Free an incremental reader
  * @param[in] reader The reader to free
@@ -0,0 +1,125 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#ifndef MSGSTREAM_BROADCAST_H
+#define MSGSTREAM_BROADCAST_H
+
+#include "msgstream.h"
+
+/**
+ * Skip messages for a subscriber that hasn't caught up with the last one
+ */
+#define MSGSTREAM_BROADCAST_DROP 0
+
+/**
+ * Disconnect a subscriber that hasn't caught up with the last message
+ */
+#define MSGSTREAM_BROADCAST_DISCONNECT 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// @private
+struct msgstream_broadcast_;
+
+/**
+ * Publishes each message to many subscriber file descriptors. On Linux, a
+ * message is framed once into an internal pipe and duplicated to subscriber
+ * pipes with tee(), so the payload is only copied from user space once no
+ * matter how many subscribers there are. Subscribers that aren't pipes, and
+ * platforms without tee(), are written to directly.
+ *
+ * Subscriber file descriptors should be non-blocking. A subscriber that can't
+ * take a whole message keeps a copy of the rest and receives it on later
+ * calls to msgstream_broadcast_publish or msgstream_broadcast_flush. If it
+ * still hasn't caught up when the next message is published, the broadcast's
+ * slow subscriber policy decides whether it misses that message or is
+ * disconnected. Subscribers lag by at most one message and never receive a
+ * partial message.
+ *
+ * A subscriber whose reader has closed is disconnected. SIGPIPE is suppressed
+ * while writing to subscribers, so callers don't need to ignore it.
+ *
+ * A broadcast is not thread safe.
+ */
+typedef struct msgstream_broadcast_ *msgstream_broadcast;
+
+/**
+ * Allocate a broadcast
+ * @param[in] buf_size The message buffer size to frame messages with
+ * @param[in] slow_policy MSGSTREAM_BROADCAST_DROP or
+ * MSGSTREAM_BROADCAST_DISCONNECT
+ * @return The allocated broadcast, or NULL
+ */
+MSGSTREAM_API msgstream_broadcast msgstream_broadcast_alloc(size_t buf_size,
+                                                            int slow_policy);
+
+/**
+ * Free a broadcast. Subscriber file descriptors are not closed.
+ * @param[in] bc The broadcast to free
+ */
+MSGSTREAM_API void msgstream_broadcast_free(msgstream_broadcast bc);
+
+/**
+ * Add a subscriber
+ * @param[in] bc The broadcast
+ * @param[in] fd The file descriptor to publish messages to
+ * @return An error code
+ */
+MSGSTREAM_API int msgstream_broadcast_add(msgstream_broadcast bc, int fd);
+
+/**
+ * Remove a subscriber, discarding the rest of any message it hasn't taken
+ * @param[in] bc The broadcast
+ * @param[in] fd The subscriber's file descriptor
+ * @return An error code
+ */
+MSGSTREAM_API int msgstream_broadcast_remove(msgstream_broadcast bc, int fd);
+
+/**
+ * Publish a message to every subscriber
+ * @param[in] bc The broadcast
+ * @param[in] buf A buffer holding the message to be published
+ * @param[in] msg_size The size of the message in bytes
+ * @return An error code
+ */
+MSGSTREAM_API int msgstream_broadcast_publish(msgstream_broadcast bc,
+                                              const void *buf,
+                                              size_t msg_size);
+
+/**
+ * Continue delivering messages that subscribers haven't fully taken
+ * @param[in] bc The broadcast
+ * @param[out] nbacklogged The number of subscribers still behind
+ * @return An error code
+ */
+MSGSTREAM_API int msgstream_broadcast_flush(msgstream_broadcast bc,
+                                            size_t *nbacklogged);
+
+/**
+ * Take the next subscriber that was disconnected, either by the slow
+ * subscriber policy or because writing to it failed
+ * @param[in] bc The broadcast
+ * @param[out] fd The disconnected subscriber's file descriptor
+ * @return 1 if a subscriber was taken, 0 if there are none
+ */
+MSGSTREAM_API int msgstream_broadcast_next_disconnected(msgstream_broadcast bc,
+                                                        int *fd);
+
+/**
+ * Count the messages that slow subscribers have missed
+ * @param[in] bc The broadcast
+ * @return The number of missed deliveries
+ */
+MSGSTREAM_API uint64_t msgstream_broadcast_dropped(msgstream_broadcast bc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,166 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#ifndef MSGSTREAM_CAPTURE_H
+#define MSGSTREAM_CAPTURE_H
+
+#include "msgstream.h"
+#include "pool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A capture is a stream of varint framed messages. The first message is a
+ * fixed magic string identifying the capture format. Every following message
+ * is a record of one received message: an 8 byte little endian timestamp in
+ * nanoseconds from a monotonic clock, a 4 byte little endian source fd, and
+ * then the message payload.
+ *
+ * The msgstream_*_capture_recv functions wrap each receive function and record
+ * the messages it completes. Messages received any other way can be recorded
+ * with msgstream_capture_write.
+ *
+ * Capture and replay functions are not thread safe for a given capture fd.
+ */
+
+/**
+ * Metadata for a captured message
+ */
+struct msgstream_capture_record {
+  /** Monotonic time the message was received in nanoseconds */
+  uint64_t timestamp_ns;
+  /** The file descriptor the message was received on */
+  int fd;
+  /** The size of the message in bytes */
+  size_t msg_size;
+};
+
+/**
+ * Write the capture header. This must be the first thing written to a capture.
+ * @param[in] capture_fd The file descriptor to write the capture to
+ * @return An error code
+ */
+MSGSTREAM_API int msgstream_capture_write_header(int capture_fd);
+
+/**
+ * Read and validate the capture header. This must be the first thing read
+ * from a capture.
+ * @param[in] capture_fd The file descriptor to read the capture from
+ * @return An error code. MSGSTREAM_BAD_CAPTURE if the header is invalid.
+ */
+MSGSTREAM_API int msgstream_capture_read_header(int capture_fd);
+
+/**
+ * Record a received message to a capture, timestamped with the current time
+ * @param[in] capture_fd The file descriptor to write the capture to
+ * @param[in] fd The file descriptor the message was received on
+ * @param[in] msg The message
+ * @param[in] msg_size The size of the message in bytes
+ * @return An error code
+ */
+MSGSTREAM_API int msgstream_capture_write(int capture_fd, int fd,
+                                          const void *msg, size_t msg_size);
+
+/**
+ * Read the next record from a capture
+ * @param[in] capture_fd The file descriptor to read the capture from
+ * @param[in] buf A buffer to hold the captured message
+ * @param[in] buf_size The size of the buffer in bytes
+ * @param[out] rec The metadata for the captured message
+ * @return An error code. MSGSTREAM_EOF at the end of the capture.
+ * MSGSTREAM_BIG_MSG if the message doesn't fit in buf, in which case rec is
+ * still filled in and the record is skipped, so the next call reads the
+ * record after it.
+ */
+MSGSTREAM_API int msgstream_capture_read(int capture_fd, void *buf,
+                                         size_t buf_size,
+                                         struct msgstream_capture_record *rec);
+
+/**
+ * Receive a message like msgstream_fd_recv and record it to a capture
+ * @param[in] fd The file decriptor to read the message from
+ * @param[in] buf A buffer to hold the received message
+ * @param[in] buf_size The size of the buffer in bytes
+ * @param[out] msg_size The size of the received message
+ * @param[in] capture_fd The file descriptor to write the capture to
+ * @return An error code
+ */
+MSGSTREAM_API int msgstream_fd_capture_recv(int fd, void *buf, size_t buf_size,
+                                            size_t *msg_size, int capture_fd);
+
+/**
+ * Receive a message like msgstream_fd_varint_recv and record it to a capture
+ * @param[in] fd The file decriptor to read the message from
+ * @param[in] buf A buffer to hold the received message
+ * @param[in] buf_size The size of the buffer in bytes
+ * @param[out] msg_size The size of the received message
+ * @param[in] capture_fd The file descriptor to write the capture to
+ * @return An error code
+ */
+MSGSTREAM_API int msgstream_fd_varint_capture_recv(int fd, void *buf,
+                                                   size_t buf_size,
+                                                   size_t *msg_size,
+                                                   int capture_fd);
+
+/**
+ * Incrementally receive a message like msgstream_fd_incremental_recv, and
+ * record it to a capture once it is complete
+ * @param[in] fd The file descriptor to read the message from
+ * @param[in] reader The message reader to decode the message
+ * @param[out] is_complete 1 if the message is complete, 0 otherwise
+ * @param[out] msg_size The size of the received message in bytes. Only valid
+ * when is_complete == 1
+ * @param[in] capture_fd The file descriptor to write the capture to
+ * @return An error code
+ */
+MSGSTREAM_API int
+msgstream_fd_incremental_capture_recv(int fd,
+                                      msgstream_incremental_reader reader,
+                                      int *is_complete, size_t *msg_size,
+                                      int capture_fd);
+
+/**
+ * Incrementally receive a message like msgstream_fd_pooled_recv, and record it
+ * to a capture once it is complete
+ * @param[in] fd The file descriptor to read the message from
+ * @param[in] reader The message reader to decode the message
+ * @param[out] is_complete 1 if the message is complete, 0 otherwise
+ * @param[out] msg The received message. Only valid when is_complete == 1 and
+ * until the message is released.
+ * @param[out] msg_size The size of the received message in bytes. Only valid
+ * when is_complete == 1
+ * @param[in] capture_fd The file descriptor to write the capture to
+ * @return An error code
+ */
+MSGSTREAM_API int
+msgstream_fd_pooled_capture_recv(int fd, struct msgstream_pooled_reader *reader,
+                                 int *is_complete, void **msg,
+                                 size_t *msg_size, int capture_fd);
+
+/**
+ * Re-send captured messages with msgstream_fd_send
+ * @param[in] capture_fd The file descriptor to read the capture from, with
+ * the header not yet read
+ * @param[in] src_fd Only replay messages captured from this fd, or -1 for all
+ * @param[in] out_fd The file descriptor to send messages to
+ * @param[in] buf_size The buffer size to frame sent messages with. Captured
+ * messages bigger than this are an error.
+ * @param[in] speed Replay at this multiple of the captured pacing, e.g. 1 for
+ * the original pacing, or 0 to send as fast as possible
+ * @return An error code
+ */
+MSGSTREAM_API int msgstream_capture_replay(int capture_fd, int src_fd,
+                                           int out_fd, size_t buf_size,
+                                           double speed);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
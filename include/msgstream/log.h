@@ -0,0 +1,112 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#ifndef MSGSTREAM_LOG_H
+#define MSGSTREAM_LOG_H
+
+#include "msgstream.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// @private
+struct msgstream_log_;
+
+/**
+ * An append-only log of msgstream framed messages with group commit. Many
+ * threads may append at once. Messages waiting while a commit is in progress
+ * are written together by the next commit with batched writev calls and a
+ * single fdatasync, and each appender returns once its message is durable.
+ *
+ * A sidecar index file holds the byte offset of every message in the log as
+ * an 8 byte little endian integer, so message N's offset is at byte 8 * N.
+ * The index is written after the log is synced and is not synced itself.
+ * Opening a log repairs an index that lags or leads the log and truncates a
+ * message that was only partially written, scanning only the tail of the log.
+ * A complete message that doesn't decode with the log's buffer size fails
+ * the open and nothing is truncated.
+ */
+typedef struct msgstream_log_ *msgstream_log;
+
+/**
+ * Open a log, recovering its index and truncating any partially written
+ * message. The file descriptors must be open for reading and writing and stay
+ * open until the log is closed.
+ * @param[in] log_fd The file descriptor of the log file
+ * @param[in] index_fd The file descriptor of the index file
+ * @param[in] buf_size The message buffer size to frame messages with
+ * @param[out] log The opened log
+ * @return An error code. MSGSTREAM_HDR_SYNC or MSGSTREAM_BIG_MSG if a message
+ * in the log wasn't framed with buf_size.
+ */
+MSGSTREAM_API int msgstream_log_open(int log_fd, int index_fd,
+                                     size_t buf_size, msgstream_log *log);
+
+/**
+ * Close a log. No thread may be appending. The file descriptors are not
+ * closed.
+ * @param[in] log The log to close
+ */
+MSGSTREAM_API void msgstream_log_close(msgstream_log log);
+
+/**
+ * Set how long a commit waits for more messages to join it before writing.
+ * The default of 0 only batches messages that arrive while the previous
+ * commit is in progress.
+ * @param[in] log The log
+ * @param[in] window_ns The commit window in nanoseconds
+ */
+MSGSTREAM_API void msgstream_log_set_commit_window(msgstream_log log,
+                                                   uint64_t window_ns);
+
+/**
+ * Append a message and wait until it is durable
+ * @param[in] log The log
+ * @param[in] buf A buffer holding the message
+ * @param[in] msg_size The size of the message in bytes
+ * @param[out] ordinal The message's position in the log, counting from 0
+ * @return An error code. Once a commit fails, every later append fails.
+ */
+MSGSTREAM_API int msgstream_log_append(msgstream_log log, const void *buf,
+                                       size_t msg_size, uint64_t *ordinal);
+
+/**
+ * Count the durable messages in the log
+ * @param[in] log The log
+ * @return The number of durable messages
+ */
+MSGSTREAM_API uint64_t msgstream_log_count(msgstream_log log);
+
+/**
+ * Look up the byte offset of a message's header in the log file
+ * @param[in] log The log
+ * @param[in] ordinal The message's position in the log
+ * @param[out] offset The byte offset of the message
+ * @return An error code. MSGSTREAM_EOF if the message isn't durable.
+ */
+MSGSTREAM_API int msgstream_log_offset(msgstream_log log, uint64_t ordinal,
+                                       uint64_t *offset);
+
+/**
+ * Read a message from the log
+ * @param[in] log The log
+ * @param[in] ordinal The message's position in the log
+ * @param[in] buf A buffer to hold the message
+ * @param[in] buf_size The size of the buffer in bytes
+ * @param[out] msg_size The size of the message in bytes
+ * @return An error code. MSGSTREAM_EOF if the message isn't durable.
+ */
+MSGSTREAM_API int msgstream_log_read(msgstream_log log, uint64_t ordinal,
+                                     void *buf, size_t buf_size,
+                                     size_t *msg_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,175 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#ifndef MSGSTREAM_MUX_H
+#define MSGSTREAM_MUX_H
+
+#include "msgstream.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Multiplexes messages on numbered channels over a single file descriptor.
+ * Messages are split into chunks of bounded size, and chunks from different
+ * channels are interleaved by channel priority so that a large message on one
+ * channel does not hold up small messages on another.
+ *
+ * Each chunk is a varint framed message whose payload is the channel number as
+ * a varint, a flags byte, and then the chunk data. The low bit of the flags is
+ * set on the final chunk of a message.
+ *
+ * Messages may be queued and channel priorities set from any thread, including
+ * while another thread is writing chunks. Only one thread at a time may write
+ * chunks. Demuxes are not thread safe.
+ *
+ * A demux reads ahead of the message it returns, so every read of its file
+ * descriptor must go through the same demux.
+ */
+
+/// @private
+struct msgstream_mux_;
+
+/**
+ * Sends messages on channels of a single file descriptor
+ */
+typedef struct msgstream_mux_ *msgstream_mux;
+
+/// @private
+struct msgstream_demux_;
+
+/**
+ * Receives messages on channels of a single file descriptor
+ */
+typedef struct msgstream_demux_ *msgstream_demux;
+
+/**
+ * Allocate a mux
+ * @param[in] fd The file descriptor to send chunks on
+ * @param[in] nchannels The number of channels, numbered from 0
+ * @param[in] chunk_size The most message bytes to send in a single chunk
+ * @return The allocated mux, or NULL
+ */
+MSGSTREAM_API msgstream_mux msgstream_mux_alloc(int fd, size_t nchannels,
+                                                size_t chunk_size);
+
+/**
+ * Free a mux. Queued messages that have not been sent are dropped.
+ * @param[in] mux The mux to free
+ */
+MSGSTREAM_API void msgstream_mux_free(msgstream_mux mux);
+
+/**
+ * Set the priority of a channel. Chunks from channels with a higher priority
+ * are sent first, and channels of equal priority take turns. All channels
+ * start with priority 0.
+ * @param[in] mux The mux
+ * @param[in] channel The channel
+ * @param[in] priority The channel's priority
+ * @return An error code
+ */
+MSGSTREAM_API int msgstream_mux_set_priority(msgstream_mux mux,
+                                             unsigned channel, int priority);
+
+/**
+ * Queue a message to be sent on a channel. The message is not copied, so buf
+ * must stay valid until msgstream_mux_queued reports that the channel's queue
+ * no longer holds it.
+ * @param[in] mux The mux
+ * @param[in] channel The channel to send the message on
+ * @param[in] buf A buffer holding the message to be sent
+ * @param[in] msg_size The size of the message in bytes
+ * @return An error code
+ */
+MSGSTREAM_API int msgstream_mux_send(msgstream_mux mux, unsigned channel,
+                                     const void *buf, size_t msg_size);
+
+/**
+ * Write the next chunk, chosen by channel priority. If a non-blocking file
+ * descriptor only takes part of a chunk, the rest of that chunk is written by
+ * the next call before any other chunk.
+ * @param[in] mux The mux
+ * @param[out] is_idle 1 if no messages were queued, so nothing was written
+ * @param[out] would_block 1 if the file descriptor would block before the
+ * chunk was fully written. Call again once it is writable.
+ * @return An error code
+ */
+MSGSTREAM_API int msgstream_mux_write_chunk(msgstream_mux mux, int *is_idle,
+                                            int *would_block);
+
+/**
+ * Write chunks until no messages are queued, or until a non-blocking file
+ * descriptor would block
+ * @param[in] mux The mux
+ * @return An error code
+ */
+MSGSTREAM_API int msgstream_mux_flush(msgstream_mux mux);
+
+/**
+ * Count the messages queued on a channel, including one partially sent
+ * @param[in] mux The mux
+ * @param[in] channel The channel
+ * @return The number of queued messages
+ */
+MSGSTREAM_API size_t msgstream_mux_queued(msgstream_mux mux, unsigned channel);
+
+/**
+ * Allocate a demux
+ * @param[in] nchannels The number of channels, numbered from 0
+ * @param[in] max_msg_size The largest message accepted on any channel
+ * @return The allocated demux, or NULL
+ */
+MSGSTREAM_API msgstream_demux msgstream_demux_alloc(size_t nchannels,
+                                                    size_t max_msg_size);
+
+/**
+ * Free a demux
+ * @param[in] demux The demux to free
+ */
+MSGSTREAM_API void msgstream_demux_free(msgstream_demux demux);
+
+/**
+ * Read chunks until a whole message has been reassembled on some channel
+ * @param[in] fd The file descriptor to read chunks from
+ * @param[in] demux The demux
+ * @param[out] channel The channel the message was received on
+ * @param[out] msg The received message. Only valid until the next call.
+ * @param[out] msg_size The size of the received message in bytes
+ * @return An error code. MSGSTREAM_HDR_SYNC if a chunk is malformed.
+ */
+MSGSTREAM_API int msgstream_demux_recv(int fd, msgstream_demux demux,
+                                       unsigned *channel, const void **msg,
+                                       size_t *msg_size);
+
+/**
+ * Reassemble chunks with at most one read() of fd, such as when it is
+ * non-blocking. When is_complete is 0, no whole message is left buffered, so
+ * it is safe to wait for fd to be readable before calling again.
+ * @param[in] fd The file descriptor to read chunks from
+ * @param[in] demux The demux
+ * @param[out] is_complete 1 if a message was reassembled, 0 otherwise
+ * @param[out] channel The channel the message was received on. Only valid
+ * when is_complete == 1
+ * @param[out] msg The received message. Only valid when is_complete == 1, and
+ * until the next call.
+ * @param[out] msg_size The size of the received message in bytes. Only valid
+ * when is_complete == 1
+ * @return An error code
+ */
+MSGSTREAM_API int msgstream_demux_incremental_recv(int fd,
+                                                   msgstream_demux demux,
+                                                   int *is_complete,
+                                                   unsigned *channel,
+                                                   const void **msg,
+                                                   size_t *msg_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,154 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#ifndef MSGSTREAM_POOL_H
+#define MSGSTREAM_POOL_H
+
+#include "msgstream.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// @private
+struct msgstream_reader_pool_;
+
+/**
+ * A pool of incremental readers and message buffers. Readers only borrow a
+ * buffer from the pool once a header has been decoded, and the buffer is sized
+ * to the message rather than the largest possible message, so memory scales
+ * with messages in flight instead of with the number of readers.
+ *
+ * A pool and its readers are not thread safe.
+ */
+typedef struct msgstream_reader_pool_ *msgstream_reader_pool;
+
+/**
+ * An incremental reader whose message buffers are borrowed from a pool. This
+ * may be embedded in a caller's struct and set up with
+ * msgstream_pooled_reader_init, or allocated from the pool with
+ * msgstream_pooled_reader_alloc. All fields are private.
+ */
+struct msgstream_pooled_reader {
+  /// @private
+  msgstream_reader_pool pool;
+  /// @private
+  uint8_t hdr_buf[MSGSTREAM_VARINT_HEADER_BUF_SIZE];
+  /// @private
+  size_t hdr_size;
+  /// @private
+  void *buf;
+  /// @private
+  size_t msg_size;
+  /// @private
+  size_t nread;
+  /// @private
+  size_t nreads;
+  /// @private
+  int stage;
+};
+
+/**
+ * Allocate a reader pool for messages with fixed size headers
+ * @param[in] buf_size The message buffer size the sender frames messages
+ * with. No received message will be bigger than this.
+ * @return The allocated pool, or NULL
+ */
+MSGSTREAM_API msgstream_reader_pool
+msgstream_reader_pool_alloc(size_t buf_size);
+
+/**
+ * Allocate a reader pool for messages with varint headers
+ * @param[in] buf_size The largest message size that readers will accept
+ * @return The allocated pool, or NULL
+ */
+MSGSTREAM_API msgstream_reader_pool
+msgstream_varint_reader_pool_alloc(size_t buf_size);
+
+/**
+ * Free a reader pool. Every reader using the pool must have been freed or
+ * cleaned up beforehand.
+ * @param[in] pool The pool to free
+ */
+MSGSTREAM_API void msgstream_reader_pool_free(msgstream_reader_pool pool);
+
+/**
+ * Free message buffers that the pool is holding on to for reuse
+ * @param[in] pool The pool to trim
+ */
+MSGSTREAM_API void msgstream_reader_pool_trim(msgstream_reader_pool pool);
+
+/**
+ * Count the message buffers currently borrowed by readers of the pool
+ * @param[in] pool The pool to query
+ * @return The number of borrowed buffers
+ */
+MSGSTREAM_API size_t
+msgstream_reader_pool_buffers_in_use(msgstream_reader_pool pool);
+
+/**
+ * Initialize a caller-owned pooled reader in place
+ * @param[out] reader The reader to initialize
+ * @param[in] pool The pool to borrow message buffers from
+ * @return An error code
+ */
+MSGSTREAM_API int
+msgstream_pooled_reader_init(struct msgstream_pooled_reader *reader,
+                             msgstream_reader_pool pool);
+
+/**
+ * Return any buffer held by a reader initialized with
+ * msgstream_pooled_reader_init. The reader may be initialized again afterward.
+ * @param[in] reader The reader to clean up
+ */
+MSGSTREAM_API void
+msgstream_pooled_reader_cleanup(struct msgstream_pooled_reader *reader);
+
+/**
+ * Allocate a pooled reader from the pool's reader slab
+ * @param[in] pool The pool to allocate from
+ * @return The allocated reader, or NULL
+ */
+MSGSTREAM_API struct msgstream_pooled_reader *
+msgstream_pooled_reader_alloc(msgstream_reader_pool pool);
+
+/**
+ * Free a pooled reader allocated with msgstream_pooled_reader_alloc
+ * @param[in] reader The reader to free
+ */
+MSGSTREAM_API void
+msgstream_pooled_reader_free(struct msgstream_pooled_reader *reader);
+
+/**
+ * Return the buffer of a completed message to the pool. This happens
+ * automatically on the next call to msgstream_fd_pooled_recv, but calling it
+ * as soon as the message is consumed keeps idle readers from holding memory.
+ * @param[in] reader The reader whose message has been consumed
+ */
+MSGSTREAM_API void
+msgstream_pooled_reader_release(struct msgstream_pooled_reader *reader);
+
+/**
+ * Incrementally receive a msgstream message into a pooled buffer
+ * @param[in] fd The file descriptor to read the message from
+ * @param[in] reader The message reader to decode the message
+ * @param[out] is_complete 1 if the message is complete, 0 otherwise
+ * @param[out] msg The received message. Only valid when is_complete == 1 and
+ * until the message is released. NULL for empty messages.
+ * @param[out] msg_size The size of the received message in bytes. Only valid
+ * when is_complete == 1
+ * @return An error code
+ */
+MSGSTREAM_API int
+msgstream_fd_pooled_recv(int fd, struct msgstream_pooled_reader *reader,
+                         int *is_complete, void **msg, size_t *msg_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
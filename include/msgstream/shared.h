@@ -0,0 +1,95 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#ifndef MSGSTREAM_SHARED_H
+#define MSGSTREAM_SHARED_H
+
+#include "msgstream.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// @private
+struct msgstream_shared_reader_;
+
+/**
+ * Lets many threads receive whole messages from one blocking file descriptor.
+ *
+ * If the file descriptor delivers one packet per read(), each consumer
+ * receives a message with a single read() and no lock, so consumers scale with
+ * the kernel rather than contending in user space. SOCK_SEQPACKET and
+ * SOCK_DGRAM sockets are detected as packet file descriptors. A pipe whose
+ * write end was opened with O_DIRECT on Linux must be marked with
+ * msgstream_shared_reader_set_packet. Every message must then be sent as one
+ * packet, which msgstream_fd_send does as long as the framed message fits in a
+ * packet. For an O_DIRECT pipe that is PIPE_BUF bytes.
+ *
+ * On any other file descriptor, consumers share a read buffer of up to 1 MiB.
+ * One consumer at a time refills it with a single read(), which usually
+ * brings in many messages, and consumers copy whole messages out of it under a
+ * short lock. A message too big for the buffer is read by one consumer
+ * directly into its own buffer while the others wait. Once a consumer sees end
+ * of file or a framing error on such a stream, every later receive returns
+ * the same error.
+ */
+typedef struct msgstream_shared_reader_ *msgstream_shared_reader;
+
+/**
+ * Allocate a shared reader for messages with fixed size headers
+ * @param[in] fd The file descriptor to read messages from
+ * @param[in] buf_size The message buffer size the sender frames messages
+ * with
+ * @return The allocated reader, or NULL
+ */
+MSGSTREAM_API msgstream_shared_reader
+msgstream_shared_reader_alloc(int fd, size_t buf_size);
+
+/**
+ * Allocate a shared reader for messages with varint headers
+ * @param[in] fd The file descriptor to read messages from
+ * @param[in] buf_size The largest message size that will be accepted
+ * @return The allocated reader, or NULL
+ */
+MSGSTREAM_API msgstream_shared_reader
+msgstream_varint_shared_reader_alloc(int fd, size_t buf_size);
+
+/**
+ * Free a shared reader. No consumer may be using it.
+ * @param[in] reader The reader to free
+ */
+MSGSTREAM_API void msgstream_shared_reader_free(msgstream_shared_reader reader);
+
+/**
+ * Set whether each read() of the file descriptor returns exactly one message.
+ * This is detected for sockets, but must be set for O_DIRECT pipes.
+ * @param[in] reader The shared reader
+ * @param[in] packet 1 if the file descriptor delivers one packet per read()
+ * @return An error code
+ */
+MSGSTREAM_API int
+msgstream_shared_reader_set_packet(msgstream_shared_reader reader, int packet);
+
+/**
+ * Receive the next message on the file descriptor
+ * @param[in] reader The shared reader
+ * @param[in] buf A buffer to hold the message
+ * @param[in] buf_size The size of the buffer in bytes. A message bigger than
+ * this is consumed and MSGSTREAM_BIG_MSG is returned, so later receives stay
+ * in sync.
+ * @param[out] msg_size The size of the received message in bytes
+ * @return An error code
+ */
+MSGSTREAM_API int msgstream_shared_recv(msgstream_shared_reader reader,
+                                        void *buf, size_t buf_size,
+                                        size_t *msg_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
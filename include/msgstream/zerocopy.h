@@ -0,0 +1,108 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#ifndef MSGSTREAM_ZEROCOPY_H
+#define MSGSTREAM_ZEROCOPY_H
+
+#include "msgstream.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// @private
+struct msgstream_zerocopy_;
+
+/**
+ * Sends messages over a socket with MSG_ZEROCOPY. The kernel transmits message
+ * bodies at or above a size threshold directly from the caller's buffer. The
+ * buffer must not be modified until the kernel reports that it is done with
+ * it. Messages below the threshold are copied as with msgstream_fd_send.
+ *
+ * Zero copy sends are only available for Linux sockets that support
+ * SO_ZEROCOPY, like TCP. Otherwise every message is copied and is complete as
+ * soon as it is sent.
+ *
+ * The kernel numbers zero copy sends per socket, so a socket gets at most one
+ * zero copy sender over its lifetime. A sender allocated for a socket that
+ * already has SO_ZEROCOPY enabled copies every message.
+ *
+ * A zero copy sender is not thread safe.
+ */
+typedef struct msgstream_zerocopy_ *msgstream_zerocopy;
+
+/**
+ * Allocate a zero copy sender, enabling SO_ZEROCOPY on the socket if possible
+ * @param[in] fd The socket to send messages on
+ * @param[in] threshold Message bodies at least this many bytes are sent with
+ * MSG_ZEROCOPY
+ * @return The allocated sender, or NULL
+ */
+MSGSTREAM_API msgstream_zerocopy msgstream_zerocopy_alloc(int fd,
+                                                          size_t threshold);
+
+/**
+ * Free a zero copy sender. This does not wait for outstanding sends.
+ * @param[in] zc The sender to free
+ */
+MSGSTREAM_API void msgstream_zerocopy_free(msgstream_zerocopy zc);
+
+/**
+ * Check whether zero copy sends are enabled on the socket
+ * @param[in] zc The sender
+ * @return 1 if enabled, 0 otherwise
+ */
+MSGSTREAM_API int msgstream_zerocopy_enabled(msgstream_zerocopy zc);
+
+/**
+ * Send a message
+ * @param[in] zc The sender
+ * @param[in] buf A buffer holding the message to be sent
+ * @param[in] buf_size The size of the buffer in bytes
+ * @param[in] msg_size The size of the message in bytes (<= buf_size)
+ * @param[out] ticket Identifies the send for msgstream_zerocopy_done and
+ * msgstream_zerocopy_wait
+ * @return An error code
+ */
+MSGSTREAM_API int msgstream_zerocopy_send(msgstream_zerocopy zc,
+                                          const void *buf, size_t buf_size,
+                                          size_t msg_size, uint64_t *ticket);
+
+/**
+ * Read any completion notifications from the socket's error queue without
+ * blocking, and check whether the kernel is done with a sent buffer
+ * @param[in] zc The sender
+ * @param[in] ticket The ticket of the send to check
+ * @param[out] is_done 1 if the buffer for the send may be reused
+ * @return An error code
+ */
+MSGSTREAM_API int msgstream_zerocopy_done(msgstream_zerocopy zc,
+                                          uint64_t ticket, int *is_done);
+
+/**
+ * Block until the kernel is done with a sent buffer
+ * @param[in] zc The sender
+ * @param[in] ticket The ticket of the send to wait for
+ * @return An error code
+ */
+MSGSTREAM_API int msgstream_zerocopy_wait(msgstream_zerocopy zc,
+                                          uint64_t ticket);
+
+/**
+ * Count the zero copy sends that the kernel completed by copying anyway, as it
+ * does for loopback. A high count means the threshold should be raised or zero
+ * copy disabled for the socket.
+ * @param[in] zc The sender
+ * @return The number of copied zero copy sends
+ */
+MSGSTREAM_API uint64_t msgstream_zerocopy_copied(msgstream_zerocopy zc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
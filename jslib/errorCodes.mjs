@@ -10,6 +10,10 @@ const defs = [
   ["SYS_READ_ERR", "read system call encountered an error"],
   ["SYS_WRITE_ERR", "write system call encountered an error"],
   ["TRUNC", "message truncated"],
+  ["ALLOC", "memory allocation failed"],
+  ["BAD_CAPTURE", "file is not a valid msgstream capture"],
+  ["BAD_CHANNEL", "channel number is out of range"],
+  ["SYS_SYNC_ERR", "fsync system call encountered an error"],
 ];
 
 export const errorCodes = defs.map((val, i) => {
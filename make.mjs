@@ -37,7 +37,18 @@ cli((make) => {
 
   const msg = d.addLibrary({
     name: "msgstream",
-    src: ["src/msgstream.c", errcC],
+    src: [
+      "src/msgstream.c",
+      "src/io.c",
+      "src/pool.c",
+      "src/capture.c",
+      "src/mux.c",
+      "src/zerocopy.c",
+      "src/shared.c",
+      "src/broadcast.c",
+      "src/log.c",
+      errcC,
+    ],
     includeDirs: [include, genInclude],
   });
 
@@ -49,13 +60,40 @@ cli((make) => {
 
   d.addTest({
     name: "msgstream_test",
-    src: ["test/msgstream_test.cpp"],
+    src: [
+      "test/msgstream_test.cpp",
+      "test/pool_test.cpp",
+      "test/capture_test.cpp",
+      "test/mux_test.cpp",
+      "test/zerocopy_test.cpp",
+      "test/shared_test.cpp",
+      "test/broadcast_test.cpp",
+      "test/log_test.cpp",
+    ],
     linkTo: [msg, gtest],
   });
 
   make.add("test", [d.test], () => {});
 
+  const replay = d.addExecutable({
+    name: "msgstream_replay",
+    src: ["tools/replay.c"],
+    linkTo: [msg],
+  });
+
+  // Benchmarks aren't part of "all" or "test". Build them with
+  // `node make.mjs bench`.
+  const benches = ["broadcast", "log", "zerocopy"].map((name) =>
+    d.addExecutable({
+      name: `bench_${name}`,
+      src: [`bench/${name}.c`],
+      linkTo: [msg],
+    }),
+  );
+
+  make.add("bench", benches.map((b) => b.binary));
+
   const compileCommands = addCompileCommands(make, d);
 
-  make.add("all", [d.test, compileCommands]);
+  make.add("all", [d.test, replay.binary, compileCommands]);
 });
@@ -0,0 +1,49 @@
+#!/bin/bash
+
+set -e
+
+if [ ! -f src/trace.h ]; then
+	echo "Please run from project root!"
+	exit 1
+fi
+
+# Usage: script/check-probes.sh [<library>...]
+# Verify that each library has a stapsdt note for every probe in src/trace.h.
+# Libraries default to every libmsgstream.* under build/.
+
+LIBS=("$@")
+if [ ${#LIBS[*]} -eq 0 ]; then
+	LIBS=($(find build -type f -name 'libmsgstream.*'))
+fi
+
+if [ ${#LIBS[*]} -eq 0 ]; then
+	echo "No libraries to check"
+	exit 1
+fi
+
+PROBES=($(grep -v '#define MSGSTREAM_PROBE' src/trace.h | \
+	sed -n 's/.*MSGSTREAM_PROBE[0-9](\([a-z_]*\),.*/\1/p'))
+if [ ${#PROBES[*]} -eq 0 ]; then
+	echo "No probes found in src/trace.h"
+	exit 1
+fi
+
+ec=0
+
+for lib in "${LIBS[@]}"; do
+	NAMES="$(readelf -n "$lib" | \
+		awk '/Provider: msgstream/ { getline; print $2 }' | sort -u)"
+
+	for probe in "${PROBES[@]}"; do
+		if ! echo "$NAMES" | grep -qx "$probe"; then
+			echo "$lib is missing probe msgstream:$probe"
+			ec=1
+		fi
+	done
+done
+
+if [ $ec -eq 0 ]; then
+	echo "Found ${#PROBES[*]} probes in ${LIBS[*]}"
+fi
+
+exit $ec
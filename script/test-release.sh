@@ -31,6 +31,12 @@ cmake -S "$MSGSTREAM" -B "$MSGSTREAM/build"
 cmake --build "$MSGSTREAM/build"
 cmake --install "$MSGSTREAM/build" --prefix "$VENDOR"
 
+if [ "$(uname)" = Linux ]; then
+	echo "Checking USDT probes"
+	script/check-probes.sh $(find "$VENDOR" -path "$VENDORSRC" -prune -o \
+		-type f -name 'libmsgstream.*' -print)
+fi
+
 TEST="$PWD/test/release"
 
 echo "Testing pkgconfig"
@@ -0,0 +1,531 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#define _GNU_SOURCE // tee, splice, pipe2, F_SETPIPE_SZ
+#include "msgstream/broadcast.h"
+#include "io.h"
+#include "trace.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/errno.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(SPLICE_F_NONBLOCK) && defined(F_SETPIPE_SZ)
+#define HAVE_TEE 1
+#endif
+
+// don't ask for an internal pipe bigger than unprivileged users may have
+#define MAX_PIPE_SIZE (1 << 20)
+
+struct subscriber {
+  int fd;
+  int use_tee;
+  int is_socket;
+
+  // rest of a message the subscriber hasn't taken yet
+  uint8_t *backlog;
+  size_t backlog_size;
+  size_t backlog_sent;
+};
+
+struct frame {
+  uint8_t hdr_buf[MSGSTREAM_HEADER_BUF_SIZE];
+  size_t hdr_size;
+  const uint8_t *body;
+  size_t msg_size;
+};
+
+struct msgstream_broadcast_ {
+  size_t buf_size;
+  size_t hdr_size;
+  int slow_policy;
+  uint64_t ndropped;
+
+  struct subscriber *subs;
+  size_t nsubs;
+  size_t subs_cap;
+
+  // subscribers whose writes may raise SIGPIPE
+  size_t nsigpipe;
+
+  int *disconnected;
+  size_t ndisconnected;
+  size_t disconnected_cap;
+
+#ifdef HAVE_TEE
+  // frames are written here once and tee'd to each subscriber. pipe_cap is 0
+  // if there is no pipe, so every frame is written directly.
+  int pipe_rd;
+  int pipe_wr;
+  size_t pipe_cap;
+  int devnull;
+#endif
+};
+
+#ifdef HAVE_TEE
+static int open_pipe(msgstream_broadcast bc) {
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) == -1) {
+    bc->pipe_rd = bc->pipe_wr = -1;
+    bc->pipe_cap = 0;
+    return -1;
+  }
+
+  bc->pipe_rd = fds[0];
+  bc->pipe_wr = fds[1];
+
+  size_t want = bc->hdr_size + bc->buf_size;
+  if (want < bc->hdr_size || want > MAX_PIPE_SIZE)
+    want = MAX_PIPE_SIZE;
+
+  // best effort. Frames that don't fit are written to subscribers directly.
+  fcntl(bc->pipe_wr, F_SETPIPE_SZ, (int)want);
+
+  int cap = fcntl(bc->pipe_wr, F_GETPIPE_SZ);
+  bc->pipe_cap = cap > 0 ? (size_t)cap : 0;
+  return 0;
+}
+
+static void close_pipe(msgstream_broadcast bc) {
+  if (bc->pipe_rd == -1)
+    return;
+
+  close(bc->pipe_rd);
+  close(bc->pipe_wr);
+  bc->pipe_rd = bc->pipe_wr = -1;
+  bc->pipe_cap = 0;
+}
+
+/*
+ * A frame that couldn't be fully staged or drained leaves bytes in the pipe
+ * that would be tee'd ahead of the next frame. Start over with an empty pipe,
+ * or write every frame directly if one can't be made.
+ */
+static void reset_pipe(msgstream_broadcast bc) {
+  close_pipe(bc);
+  open_pipe(bc);
+}
+#endif
+
+msgstream_broadcast msgstream_broadcast_alloc(size_t buf_size,
+                                              int slow_policy) {
+  if (slow_policy != MSGSTREAM_BROADCAST_DROP &&
+      slow_policy != MSGSTREAM_BROADCAST_DISCONNECT)
+    return NULL;
+
+  struct msgstream_broadcast_ *bc =
+      calloc(1, sizeof(struct msgstream_broadcast_));
+
+  if (!bc)
+    return NULL;
+
+  if (msgstream_header_size(buf_size, &bc->hdr_size)) {
+    free(bc);
+    return NULL;
+  }
+
+  bc->buf_size = buf_size;
+  bc->slow_policy = slow_policy;
+
+#ifdef HAVE_TEE
+  if (open_pipe(bc) == -1) {
+    free(bc);
+    return NULL;
+  }
+
+  bc->devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+#endif
+
+  return bc;
+}
+
+void msgstream_broadcast_free(msgstream_broadcast bc) {
+  if (!bc)
+    return;
+
+  for (size_t i = 0; i < bc->nsubs; ++i)
+    free(bc->subs[i].backlog);
+
+  free(bc->subs);
+  free(bc->disconnected);
+
+#ifdef HAVE_TEE
+  close_pipe(bc);
+  if (bc->devnull != -1)
+    close(bc->devnull);
+#endif
+
+  free(bc);
+}
+
+int msgstream_broadcast_add(msgstream_broadcast bc, int fd) {
+  if (!bc)
+    return MSGSTREAM_NULL_ARG;
+
+  if (bc->nsubs == bc->subs_cap) {
+    size_t cap = bc->subs_cap ? 2 * bc->subs_cap : 8;
+    struct subscriber *subs =
+        realloc(bc->subs, cap * sizeof(struct subscriber));
+    if (!subs)
+      return MSGSTREAM_ALLOC;
+
+    bc->subs = subs;
+    bc->subs_cap = cap;
+  }
+
+  int type;
+  socklen_t len = sizeof(type);
+  int is_socket = getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) == 0;
+
+  struct subscriber *sub = &bc->subs[bc->nsubs++];
+  sub->fd = fd;
+  sub->use_tee = !is_socket;
+#ifdef MSG_NOSIGNAL
+  sub->is_socket = is_socket;
+#else
+  sub->is_socket = 0;
+#endif
+  if (!sub->is_socket)
+    bc->nsigpipe += 1;
+
+  sub->backlog = NULL;
+  sub->backlog_size = 0;
+  sub->backlog_sent = 0;
+  return MSGSTREAM_OK;
+}
+
+static void remove_at(msgstream_broadcast bc, size_t i) {
+  if (!bc->subs[i].is_socket)
+    bc->nsigpipe -= 1;
+
+  free(bc->subs[i].backlog);
+  bc->subs[i] = bc->subs[--bc->nsubs];
+}
+
+int msgstream_broadcast_remove(msgstream_broadcast bc, int fd) {
+  if (!bc)
+    return MSGSTREAM_NULL_ARG;
+
+  for (size_t i = 0; i < bc->nsubs; ++i) {
+    if (bc->subs[i].fd == fd) {
+      remove_at(bc, i);
+      break;
+    }
+  }
+
+  return MSGSTREAM_OK;
+}
+
+static int disconnect(msgstream_broadcast bc, size_t i) {
+  if (bc->ndisconnected == bc->disconnected_cap) {
+    size_t cap = bc->disconnected_cap ? 2 * bc->disconnected_cap : 8;
+    int *fds = realloc(bc->disconnected, cap * sizeof(int));
+    if (!fds)
+      return MSGSTREAM_ALLOC;
+
+    bc->disconnected = fds;
+    bc->disconnected_cap = cap;
+  }
+
+  bc->disconnected[bc->ndisconnected++] = bc->subs[i].fd;
+  remove_at(bc, i);
+  return MSGSTREAM_OK;
+}
+
+int msgstream_broadcast_next_disconnected(msgstream_broadcast bc, int *fd) {
+  if (!(bc && fd) || bc->ndisconnected == 0)
+    return 0;
+
+  *fd = bc->disconnected[--bc->ndisconnected];
+  return 1;
+}
+
+uint64_t msgstream_broadcast_dropped(msgstream_broadcast bc) {
+  return bc ? bc->ndropped : 0;
+}
+
+/*
+ * Writing to a pipe whose reader has closed raises SIGPIPE, which kills the
+ * process by default. Sockets are sent with MSG_NOSIGNAL, and SIGPIPE is
+ * blocked around writes to everything else. Any SIGPIPE raised meanwhile is
+ * consumed before unblocking so the subscriber is only disconnected.
+ */
+struct sigpipe_guard {
+  int active;
+  int was_pending;
+  sigset_t old;
+};
+
+static void block_sigpipe(msgstream_broadcast bc, struct sigpipe_guard *g) {
+  g->active = 0;
+  if (bc->nsigpipe == 0)
+    return;
+
+  sigset_t set, pending;
+  sigemptyset(&set);
+  sigaddset(&set, SIGPIPE);
+
+  // one the caller already had blocked and pending isn't ours to consume
+  g->was_pending = sigpending(&pending) == 0 && sigismember(&pending, SIGPIPE);
+  g->active = pthread_sigmask(SIG_BLOCK, &set, &g->old) == 0;
+}
+
+static void unblock_sigpipe(const struct sigpipe_guard *g) {
+  if (!g->active)
+    return;
+
+  sigset_t set, pending;
+  sigemptyset(&set);
+  sigaddset(&set, SIGPIPE);
+
+  if (!g->was_pending && sigpending(&pending) == 0 &&
+      sigismember(&pending, SIGPIPE)) {
+#ifdef __linux__
+    struct timespec zero = {0, 0};
+    while (sigtimedwait(&set, NULL, &zero) == -1 && errno == EINTR)
+      ;
+#else
+    int sig;
+    sigwait(&set, &sig);
+#endif
+  }
+
+  pthread_sigmask(SIG_SETMASK, &g->old, NULL);
+}
+
+static int write_some(const struct subscriber *sub, struct iovec *iov,
+                      int iovcnt, size_t *nsent) {
+#ifdef MSG_NOSIGNAL
+  if (sub->is_socket)
+    return msgstream_io_sendmsg_some(sub->fd, iov, iovcnt, MSG_NOSIGNAL,
+                                     nsent);
+#endif
+
+  return msgstream_io_writev_some(sub->fd, iov, iovcnt, nsent);
+}
+
+static int frame_iov(const struct frame *f, struct iovec *iov) {
+  iov[0].iov_base = (void *)f->hdr_buf;
+  iov[0].iov_len = f->hdr_size;
+  iov[1].iov_base = (void *)f->body;
+  iov[1].iov_len = f->msg_size;
+  return f->msg_size > 0 ? 2 : 1;
+}
+
+static int flush_backlog(struct subscriber *sub) {
+  if (!sub->backlog)
+    return MSGSTREAM_OK;
+
+  struct iovec iov;
+  iov.iov_base = sub->backlog + sub->backlog_sent;
+  iov.iov_len = sub->backlog_size - sub->backlog_sent;
+
+  size_t n;
+  int ec = write_some(sub, &iov, 1, &n);
+  if (ec)
+    return ec;
+
+  sub->backlog_sent += n;
+  if (sub->backlog_sent == sub->backlog_size) {
+    MSGSTREAM_TRACE_SEND_DONE(sub->fd, sub->backlog_size);
+    free(sub->backlog);
+    sub->backlog = NULL;
+  }
+
+  return MSGSTREAM_OK;
+}
+
+// keep whatever the subscriber didn't take so later flushes can finish it
+static int save_backlog(struct subscriber *sub, const struct frame *f,
+                        size_t nsent) {
+  size_t total = f->hdr_size + f->msg_size;
+  if (nsent > 0)
+    MSGSTREAM_TRACE_WRITE_PARTIAL(sub->fd, nsent, total);
+
+  sub->backlog_size = total - nsent;
+  sub->backlog_sent = 0;
+  sub->backlog = malloc(sub->backlog_size);
+  if (!sub->backlog)
+    return MSGSTREAM_ALLOC;
+
+  uint8_t *p = sub->backlog;
+  if (nsent < f->hdr_size) {
+    memcpy(p, f->hdr_buf + nsent, f->hdr_size - nsent);
+    p += f->hdr_size - nsent;
+    nsent = f->hdr_size;
+  }
+
+  if (f->msg_size > 0)
+    memcpy(p, f->body + (nsent - f->hdr_size), total - nsent);
+
+  return MSGSTREAM_OK;
+}
+
+static int deliver(msgstream_broadcast bc, struct subscriber *sub,
+                   const struct frame *f, int in_pipe) {
+  size_t total = f->hdr_size + f->msg_size, nsent = 0;
+  int sent = 0;
+
+#ifdef HAVE_TEE
+  if (in_pipe && sub->use_tee) {
+    ssize_t n = tee(bc->pipe_rd, sub->fd, total, SPLICE_F_NONBLOCK);
+    if (n >= 0) {
+      nsent = n;
+      sent = 1;
+    } else if (errno == EAGAIN) {
+      sent = 1;
+    } else if (errno == EINVAL) {
+      sub->use_tee = 0; // not a pipe
+    } else {
+      return MSGSTREAM_SYS_WRITE_ERR;
+    }
+  }
+#else
+  (void)bc;
+  (void)in_pipe;
+#endif
+
+  if (!sent) {
+    struct iovec iov[2];
+    int ec = write_some(sub, iov, frame_iov(f, iov), &nsent);
+    if (ec)
+      return ec;
+  }
+
+  if (nsent < total)
+    return save_backlog(sub, f, nsent);
+
+  MSGSTREAM_TRACE_SEND_DONE(sub->fd, f->msg_size);
+  return MSGSTREAM_OK;
+}
+
+#ifdef HAVE_TEE
+static int stage_frame(msgstream_broadcast bc, const struct frame *f) {
+  struct iovec iov[2];
+  return msgstream_io_writevn(bc->pipe_wr, iov, frame_iov(f, iov));
+}
+
+static int drain_frame(msgstream_broadcast bc, size_t total) {
+  if (bc->devnull != -1) {
+    while (total > 0) {
+      ssize_t n = splice(bc->pipe_rd, NULL, bc->devnull, NULL, total, 0);
+      if (n <= 0)
+        return MSGSTREAM_SYS_READ_ERR;
+
+      total -= n;
+    }
+
+    return MSGSTREAM_OK;
+  }
+
+  uint8_t scratch[4096];
+  while (total > 0) {
+    size_t want = total < sizeof(scratch) ? total : sizeof(scratch);
+    ssize_t n = read(bc->pipe_rd, scratch, want);
+    if (n <= 0)
+      return MSGSTREAM_SYS_READ_ERR;
+
+    total -= n;
+  }
+
+  return MSGSTREAM_OK;
+}
+#endif
+
+int msgstream_broadcast_publish(msgstream_broadcast bc, const void *buf,
+                                size_t msg_size) {
+  if (!bc || (!buf && msg_size > 0))
+    return MSGSTREAM_NULL_ARG;
+
+  struct frame f;
+  f.hdr_size = bc->hdr_size;
+  f.body = buf;
+  f.msg_size = msg_size;
+
+  int ec = msgstream_encode_header(msg_size, f.hdr_size, f.hdr_buf);
+  if (ec)
+    return ec;
+
+  int in_pipe = 0;
+#ifdef HAVE_TEE
+  size_t total = f.hdr_size + msg_size;
+  if (bc->nsubs > 0 && total <= bc->pipe_cap) {
+    if (stage_frame(bc, &f) == MSGSTREAM_OK)
+      in_pipe = 1;
+    else
+      reset_pipe(bc);
+  }
+#endif
+
+  struct sigpipe_guard guard;
+  block_sigpipe(bc, &guard);
+
+  // backwards so removing a subscriber doesn't skip any
+  for (size_t i = bc->nsubs; i > 0; --i) {
+    struct subscriber *sub = &bc->subs[i - 1];
+
+    int slow = 0;
+    ec = flush_backlog(sub);
+    if (!ec && sub->backlog) {
+      if (bc->slow_policy == MSGSTREAM_BROADCAST_DROP) {
+        bc->ndropped += 1;
+        continue;
+      }
+
+      slow = 1;
+    }
+
+    if (!(ec || slow))
+      ec = deliver(bc, sub, &f, in_pipe);
+
+    // a failed subscriber may hold a partial frame, so it can't stay
+    if ((ec || slow) && (ec = disconnect(bc, i - 1)))
+      break;
+  }
+
+  unblock_sigpipe(&guard);
+
+#ifdef HAVE_TEE
+  // subscribers already have the frame, so this isn't the caller's error
+  if (in_pipe && drain_frame(bc, total))
+    reset_pipe(bc);
+#endif
+
+  return ec;
+}
+
+int msgstream_broadcast_flush(msgstream_broadcast bc, size_t *nbacklogged) {
+  if (!(bc && nbacklogged))
+    return MSGSTREAM_NULL_ARG;
+
+  struct sigpipe_guard guard;
+  block_sigpipe(bc, &guard);
+
+  int ec = MSGSTREAM_OK;
+  *nbacklogged = 0;
+  for (size_t i = bc->nsubs; i > 0; --i) {
+    struct subscriber *sub = &bc->subs[i - 1];
+    if (flush_backlog(sub)) {
+      if ((ec = disconnect(bc, i - 1)))
+        break;
+
+      continue;
+    }
+
+    if (sub->backlog)
+      *nbacklogged += 1;
+  }
+
+  unblock_sigpipe(&guard);
+  return ec;
+}
@@ -0,0 +1,232 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#define _GNU_SOURCE // clock_gettime, CLOCK_MONOTONIC, nanosleep
+#include "msgstream/capture.h"
+#include "io.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/errno.h>
+#include <time.h>
+
+static const char magic[] = "msgstream capture v1";
+
+// timestamp + fd preceding the message in each record
+#define RECORD_META_SIZE 12
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t deadline_ns) {
+  uint64_t now;
+  while ((now = now_ns()) < deadline_ns) {
+    uint64_t remaining = deadline_ns - now;
+    struct timespec ts;
+    ts.tv_sec = remaining / 1000000000;
+    ts.tv_nsec = remaining % 1000000000;
+    nanosleep(&ts, NULL);
+  }
+}
+
+static void encode_le(uint64_t n, size_t size, uint8_t *buf) {
+  for (size_t i = 0; i < size; ++i) {
+    buf[i] = n % 256;
+    n /= 256;
+  }
+}
+
+static uint64_t decode_le(size_t size, const uint8_t *buf) {
+  uint64_t n = 0;
+  for (size_t i = size; i > 0; --i)
+    n = n * 256 + buf[i - 1];
+
+  return n;
+}
+
+int msgstream_capture_write_header(int capture_fd) {
+  return msgstream_fd_varint_send(capture_fd, magic, sizeof(magic) - 1);
+}
+
+int msgstream_capture_read_header(int capture_fd) {
+  char buf[sizeof(magic)];
+  size_t msg_size;
+  int ec = msgstream_fd_varint_recv(capture_fd, buf, sizeof(buf), &msg_size);
+  if (ec == MSGSTREAM_BIG_MSG || ec == MSGSTREAM_BIG_HDR)
+    return MSGSTREAM_BAD_CAPTURE;
+
+  if (ec)
+    return ec;
+
+  if (msg_size != sizeof(magic) - 1 || memcmp(buf, magic, msg_size) != 0)
+    return MSGSTREAM_BAD_CAPTURE;
+
+  return MSGSTREAM_OK;
+}
+
+int msgstream_capture_write(int capture_fd, int fd, const void *msg,
+                            size_t msg_size) {
+  if (!msg && msg_size > 0)
+    return MSGSTREAM_NULL_ARG;
+
+  uint8_t hdr_buf[MSGSTREAM_VARINT_HEADER_BUF_SIZE + RECORD_META_SIZE];
+  size_t hdr_size;
+  int ec = msgstream_varint_encode_header(RECORD_META_SIZE + msg_size, hdr_buf,
+                                          MSGSTREAM_VARINT_HEADER_BUF_SIZE,
+                                          &hdr_size);
+  if (ec)
+    return ec;
+
+  encode_le(now_ns(), 8, hdr_buf + hdr_size);
+  encode_le((uint32_t)fd, 4, hdr_buf + hdr_size + 8);
+
+  struct iovec iov[2];
+  iov[0].iov_base = hdr_buf;
+  iov[0].iov_len = hdr_size + RECORD_META_SIZE;
+  iov[1].iov_base = (void *)msg;
+  iov[1].iov_len = msg_size;
+
+  return msgstream_io_writevn(capture_fd, iov, msg_size > 0 ? 2 : 1);
+}
+
+static int skip(int fd, size_t n, const uint8_t **carry, size_t *ncarry,
+                size_t *nreads) {
+  uint8_t scratch[4096];
+  while (n > 0) {
+    size_t chunk = n < sizeof(scratch) ? n : sizeof(scratch);
+    int ec =
+        msgstream_io_readn_carry(fd, scratch, chunk, carry, ncarry, nreads);
+    if (ec)
+      return ec == MSGSTREAM_EOF ? MSGSTREAM_TRUNC : ec;
+
+    n -= chunk;
+  }
+
+  return MSGSTREAM_OK;
+}
+
+int msgstream_capture_read(int capture_fd, void *buf, size_t buf_size,
+                           struct msgstream_capture_record *rec) {
+  if (!rec)
+    return MSGSTREAM_NULL_ARG;
+
+  uint8_t hdr_buf[MSGSTREAM_VARINT_HEADER_BUF_SIZE];
+  size_t nreads = 0, hdr_size, payload_size, nread;
+  int ec = msgstream_io_read_varint_header(capture_fd, hdr_buf, &hdr_size,
+                                           &payload_size, &nread, &nreads);
+  if (ec)
+    return ec;
+
+  if (payload_size < RECORD_META_SIZE)
+    return MSGSTREAM_BAD_CAPTURE;
+
+  const uint8_t *carry = hdr_buf + hdr_size;
+  size_t ncarry = nread - hdr_size;
+
+  uint8_t meta[RECORD_META_SIZE];
+  if ((ec = msgstream_io_readn_carry(capture_fd, meta, sizeof(meta), &carry,
+                                     &ncarry, &nreads)))
+    return ec == MSGSTREAM_EOF ? MSGSTREAM_TRUNC : ec;
+
+  size_t msg_size = payload_size - RECORD_META_SIZE;
+  rec->timestamp_ns = decode_le(8, meta);
+  rec->fd = (int)(int32_t)decode_le(4, meta + 8);
+  rec->msg_size = msg_size;
+
+  if (msg_size > buf_size) {
+    // skip the message so the next read starts at the next record
+    ec = skip(capture_fd, msg_size, &carry, &ncarry, &nreads);
+    return ec ? ec : MSGSTREAM_BIG_MSG;
+  }
+
+  if ((ec = msgstream_io_readn_carry(capture_fd, buf, msg_size, &carry,
+                                     &ncarry, &nreads)))
+    return ec == MSGSTREAM_EOF ? MSGSTREAM_TRUNC : ec;
+
+  return MSGSTREAM_OK;
+}
+
+int msgstream_fd_capture_recv(int fd, void *buf, size_t buf_size,
+                              size_t *msg_size, int capture_fd) {
+  int ec = msgstream_fd_recv(fd, buf, buf_size, msg_size);
+  if (ec)
+    return ec;
+
+  return msgstream_capture_write(capture_fd, fd, buf, *msg_size);
+}
+
+int msgstream_fd_varint_capture_recv(int fd, void *buf, size_t buf_size,
+                                     size_t *msg_size, int capture_fd) {
+  int ec = msgstream_fd_varint_recv(fd, buf, buf_size, msg_size);
+  if (ec)
+    return ec;
+
+  return msgstream_capture_write(capture_fd, fd, buf, *msg_size);
+}
+
+int msgstream_fd_incremental_capture_recv(int fd,
+                                          msgstream_incremental_reader reader,
+                                          int *is_complete, size_t *msg_size,
+                                          int capture_fd) {
+  int ec = msgstream_fd_incremental_recv(fd, reader, is_complete, msg_size);
+  if (ec || !*is_complete)
+    return ec;
+
+  return msgstream_capture_write(capture_fd, fd,
+                                 msgstream_io_incremental_reader_buf(reader),
+                                 *msg_size);
+}
+
+int msgstream_fd_pooled_capture_recv(int fd,
+                                     struct msgstream_pooled_reader *reader,
+                                     int *is_complete, void **msg,
+                                     size_t *msg_size, int capture_fd) {
+  int ec = msgstream_fd_pooled_recv(fd, reader, is_complete, msg, msg_size);
+  if (ec || !*is_complete)
+    return ec;
+
+  return msgstream_capture_write(capture_fd, fd, *msg, *msg_size);
+}
+
+int msgstream_capture_replay(int capture_fd, int src_fd, int out_fd,
+                             size_t buf_size, double speed) {
+  int ec = msgstream_capture_read_header(capture_fd);
+  if (ec)
+    return ec;
+
+  void *buf = malloc(buf_size);
+  if (!buf)
+    return MSGSTREAM_ALLOC;
+
+  int first = 1;
+  uint64_t start_ns = 0, first_ts = 0;
+
+  struct msgstream_capture_record rec;
+  while ((ec = msgstream_capture_read(capture_fd, buf, buf_size, &rec)) ==
+         MSGSTREAM_OK) {
+    if (src_fd != -1 && rec.fd != src_fd)
+      continue;
+
+    if (first) {
+      first = 0;
+      start_ns = now_ns();
+      first_ts = rec.timestamp_ns;
+    } else if (speed > 0 && rec.timestamp_ns > first_ts) {
+      double offset = (rec.timestamp_ns - first_ts) / speed;
+      sleep_until(start_ns + (uint64_t)offset);
+    }
+
+    if ((ec = msgstream_fd_send(out_fd, buf, buf_size, rec.msg_size)))
+      break;
+  }
+
+  free(buf);
+  return ec == MSGSTREAM_EOF ? MSGSTREAM_OK : ec;
+}
@@ -0,0 +1,239 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#include "io.h"
+#include "trace.h"
+
+#include <string.h>
+#include <sys/errno.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+int msgstream_io_readn(int fd, void *buf, size_t nbytes, size_t *nreads) {
+  int expect_eof = 1;
+  size_t nread = 0;
+  while (nbytes > nread) {
+    ssize_t n = read(fd, buf + nread, nbytes - nread);
+    *nreads += 1;
+    if (n == -1)
+      return MSGSTREAM_SYS_READ_ERR;
+
+    if (n == 0)
+      return expect_eof ? MSGSTREAM_EOF : MSGSTREAM_TRUNC;
+
+    if ((size_t)n < nbytes - nread)
+      MSGSTREAM_TRACE_READ_PARTIAL(fd, n, nbytes - nread);
+
+    nread += n;
+    expect_eof = 0;
+  }
+
+  return MSGSTREAM_OK;
+}
+
+int msgstream_io_writevn(int fd, struct iovec *iov, int iovcnt) {
+  while (iovcnt > 0) {
+    ssize_t n = writev(fd, iov, iovcnt);
+    if (n == -1)
+      return MSGSTREAM_SYS_WRITE_ERR;
+
+    size_t nwant = 0;
+    for (int i = 0; i < iovcnt; ++i)
+      nwant += iov[i].iov_len;
+
+    if ((size_t)n < nwant)
+      MSGSTREAM_TRACE_WRITE_PARTIAL(fd, n, nwant);
+
+    // skip past whatever was fully written and advance a partial iovec
+    while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+      n -= iov->iov_len;
+      ++iov;
+      --iovcnt;
+    }
+
+    if (iovcnt > 0) {
+      iov->iov_base = (uint8_t *)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+
+  return MSGSTREAM_OK;
+}
+
+// writev, or sendmsg with *send_flags if given
+static int write_some(int fd, struct iovec *iov, int iovcnt,
+                      const int *send_flags, size_t *nwritten) {
+  *nwritten = 0;
+  while (iovcnt > 0) {
+    ssize_t n;
+    if (send_flags) {
+      struct msghdr msg = {0};
+      msg.msg_iov = iov;
+      msg.msg_iovlen = iovcnt;
+      n = sendmsg(fd, &msg, *send_flags);
+    } else {
+      n = writev(fd, iov, iovcnt);
+    }
+
+    if (n == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return MSGSTREAM_OK;
+
+      return MSGSTREAM_SYS_WRITE_ERR;
+    }
+
+    *nwritten += n;
+    while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+      n -= iov->iov_len;
+      ++iov;
+      --iovcnt;
+    }
+
+    if (iovcnt > 0) {
+      iov->iov_base = (uint8_t *)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+
+  return MSGSTREAM_OK;
+}
+
+int msgstream_io_writev_some(int fd, struct iovec *iov, int iovcnt,
+                             size_t *nwritten) {
+  return write_some(fd, iov, iovcnt, NULL, nwritten);
+}
+
+int msgstream_io_sendmsg_some(int fd, struct iovec *iov, int iovcnt,
+                              int flags, size_t *nwritten) {
+  return write_some(fd, iov, iovcnt, &flags, nwritten);
+}
+
+int msgstream_io_incremental_readn(int fd, size_t n, uint8_t *buf,
+                                   size_t *pnread, size_t *nreads) {
+  size_t nread = *pnread;
+  if (nread >= n) {
+    return MSGSTREAM_OK;
+  }
+
+  size_t nleft = n - nread;
+  ssize_t nbytes = read(fd, buf + nread, nleft);
+  *nreads += 1;
+  if (nbytes < 0) {
+    if (errno == EAGAIN) {
+      MSGSTREAM_TRACE_EAGAIN(fd);
+      return MSGSTREAM_OK;
+    } else {
+      return MSGSTREAM_SYS_READ_ERR;
+    }
+  } else if (nbytes == 0) {
+    if (nread == 0) {
+      return MSGSTREAM_EOF;
+    } else {
+      return MSGSTREAM_TRUNC;
+    }
+  } else {
+    if ((size_t)nbytes < nleft)
+      MSGSTREAM_TRACE_READ_PARTIAL(fd, nbytes, nleft);
+
+    *pnread = nread + nbytes;
+    return MSGSTREAM_OK;
+  }
+}
+
+int msgstream_io_readn_carry(int fd, void *buf, size_t nbytes,
+                             const uint8_t **carry, size_t *ncarry,
+                             size_t *nreads) {
+  size_t n = *ncarry < nbytes ? *ncarry : nbytes;
+  if (n > 0) {
+    memcpy(buf, *carry, n);
+    *carry += n;
+    *ncarry -= n;
+  }
+
+  int ec = msgstream_io_readn(fd, (uint8_t *)buf + n, nbytes - n, nreads);
+  if (ec == MSGSTREAM_EOF && n > 0)
+    return MSGSTREAM_TRUNC;
+
+  return ec;
+}
+
+int msgstream_io_read_varint_header(int fd, uint8_t *hdr_buf, size_t *hdr_size,
+                                    size_t *msg_size, size_t *nread,
+                                    size_t *nreads) {
+  *nread = 0;
+  int ec = msgstream_io_readn(fd, hdr_buf, 1, nreads);
+  if (ec)
+    return ec;
+
+  *nread = 1;
+  if (hdr_buf[0] & 0x80) {
+    ec = msgstream_io_readn(fd, hdr_buf + 1,
+                            MSGSTREAM_VARINT_HEADER_BUF_SIZE - 1, nreads);
+    if (ec)
+      return ec == MSGSTREAM_EOF ? MSGSTREAM_TRUNC : ec;
+
+    *nread = MSGSTREAM_VARINT_HEADER_BUF_SIZE;
+  }
+
+  return msgstream_varint_decode_header(hdr_buf, *nread, hdr_size, msg_size);
+}
+
+static int incremental_varint_header(int fd, uint8_t *hdr_buf,
+                                     size_t *hdr_size, size_t *nread,
+                                     int *is_complete, size_t *msg_size,
+                                     size_t *nreads) {
+  int ec = MSGSTREAM_SMALL_HDR;
+  while (ec == MSGSTREAM_SMALL_HDR) {
+    size_t prev = *nread;
+
+    // the first byte alone so a one byte header doesn't consume payload. a
+    // longer header is followed by enough payload to fill hdr_buf
+    size_t want = prev == 0 ? 1 : MSGSTREAM_VARINT_HEADER_BUF_SIZE;
+    ec = msgstream_io_incremental_readn(fd, want, hdr_buf, nread, nreads);
+    if (ec != MSGSTREAM_OK)
+      return ec;
+
+    if (*nread == prev) // EAGAIN
+      return MSGSTREAM_OK;
+
+    ec = msgstream_varint_decode_header(hdr_buf, *nread, hdr_size, msg_size);
+  }
+
+  if (ec == MSGSTREAM_OK)
+    *is_complete = 1;
+
+  return ec;
+}
+
+int msgstream_io_incremental_header(int fd, int varint, uint8_t *hdr_buf,
+                                    size_t *hdr_size, size_t *nread,
+                                    int *is_complete, size_t *msg_size,
+                                    size_t *nreads) {
+  *is_complete = 0;
+
+  if (varint)
+    return incremental_varint_header(fd, hdr_buf, hdr_size, nread,
+                                     is_complete, msg_size, nreads);
+
+  int ec =
+      msgstream_io_incremental_readn(fd, *hdr_size, hdr_buf, nread, nreads);
+  if (ec != MSGSTREAM_OK)
+    return ec;
+
+  if (*nread == *hdr_size) {
+    ec = msgstream_decode_header(hdr_buf, *hdr_size, msg_size);
+    if (ec == MSGSTREAM_OK)
+      *is_complete = 1;
+
+    return ec;
+  } else if (*nread > 0) {
+    if (hdr_buf[0] != *hdr_size)
+      return MSGSTREAM_HDR_SYNC;
+  }
+
+  return MSGSTREAM_OK;
+}
@@ -0,0 +1,106 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#ifndef MSGSTREAM_IO_H
+#define MSGSTREAM_IO_H
+
+#include "msgstream.h"
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+/*
+ * Internal I/O helpers shared between the msgstream translation units. These
+ * are not part of the public API.
+ */
+
+/**
+ * Read exactly nbytes from fd, retrying on short reads. *nreads is
+ * incremented for each read() call. EINTR is an error, so a signal can break
+ * a caller out of a blocked read.
+ * @return MSGSTREAM_EOF if no bytes could be read before end of file,
+ * MSGSTREAM_TRUNC if end of file was reached part way through
+ */
+int msgstream_io_readn(int fd, void *buf, size_t nbytes, size_t *nreads);
+
+/**
+ * Write all of the given iovecs to fd, retrying on short writes. The iovecs
+ * are modified to track progress.
+ */
+int msgstream_io_writevn(int fd, struct iovec *iov, int iovcnt);
+
+/**
+ * Write as much of the given iovecs to fd as it will take without blocking,
+ * retrying on short writes. EAGAIN is not an error. The iovecs are modified to
+ * track progress.
+ * @param[out] nwritten The number of bytes written
+ */
+int msgstream_io_writev_some(int fd, struct iovec *iov, int iovcnt,
+                             size_t *nwritten);
+
+/**
+ * Like msgstream_io_writev_some, but for sockets, passing flags to sendmsg()
+ */
+int msgstream_io_sendmsg_some(int fd, struct iovec *iov, int iovcnt,
+                              int flags, size_t *nwritten);
+
+/**
+ * Make a single read() toward filling n bytes of buf, tracking progress in
+ * *pnread and incrementing *nreads if read() was called. EAGAIN is not an
+ * error and leaves *pnread unchanged.
+ */
+int msgstream_io_incremental_readn(int fd, size_t n, uint8_t *buf,
+                                   size_t *pnread, size_t *nreads);
+
+/**
+ * Like msgstream_io_readn, but first takes the *ncarry bytes at *carry, which
+ * were already read from fd, advancing *carry past the bytes it takes
+ */
+int msgstream_io_readn_carry(int fd, void *buf, size_t nbytes,
+                             const uint8_t **carry, size_t *ncarry,
+                             size_t *nreads);
+
+/**
+ * Blocking read of a varint header. A one byte header is read alone. Longer
+ * headers are read with the rest of MSGSTREAM_VARINT_HEADER_BUF_SIZE bytes at
+ * once, which can't pass the end of the message because a multi-byte header
+ * precedes at least 128 payload bytes.
+ * @param[out] hdr_buf Buffer of MSGSTREAM_VARINT_HEADER_BUF_SIZE bytes. Bytes
+ * [*hdr_size, *nread) are the start of the payload.
+ * @param[out] nread The number of bytes read into hdr_buf
+ */
+int msgstream_io_read_varint_header(int fd, uint8_t *hdr_buf, size_t *hdr_size,
+                                    size_t *msg_size, size_t *nread,
+                                    size_t *nreads);
+
+/**
+ * Progress reading a message header without blocking
+ * @param[in] fd The file descriptor to read from
+ * @param[in] varint Nonzero if the header is a varint header
+ * @param[in,out] hdr_buf Buffer of at least MSGSTREAM_VARINT_HEADER_BUF_SIZE
+ * bytes holding the partially read header
+ * @param[in,out] hdr_size The expected header size for fixed headers. Set to
+ * the decoded header size for varint headers.
+ * @param[in,out] nread The number of bytes read into hdr_buf so far. Once a
+ * varint header is complete, bytes [*hdr_size, *nread) are the start of the
+ * payload, read ahead as msgstream_io_read_varint_header does.
+ * @param[out] is_complete 1 if the header has been fully read and decoded
+ * @param[out] msg_size The decoded message size when is_complete == 1
+ * @param[in,out] nreads Incremented for each read() call
+ * @return An error code
+ */
+int msgstream_io_incremental_header(int fd, int varint, uint8_t *hdr_buf,
+                                    size_t *hdr_size, size_t *nread,
+                                    int *is_complete, size_t *msg_size,
+                                    size_t *nreads);
+
+/**
+ * The buffer an incremental reader receives messages into
+ */
+void *msgstream_io_incremental_reader_buf(msgstream_incremental_reader reader);
+
+#endif
@@ -0,0 +1,512 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#define _GNU_SOURCE // fdatasync, pread, pwrite
+#include "msgstream/log.h"
+#include "io.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/errno.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+#define INDEX_ENTRY_SIZE 8
+
+// an appender waiting for its message to be committed. lives on the
+// appender's stack, which stays put because it blocks until durable
+struct log_entry {
+  struct log_entry *next;
+  const void *buf;
+  size_t msg_size;
+  uint8_t hdr_buf[MSGSTREAM_HEADER_BUF_SIZE];
+  uint64_t offset;
+};
+
+struct msgstream_log_ {
+  int log_fd;
+  int index_fd;
+  size_t buf_size;
+  size_t hdr_size;
+  uint64_t window_ns;
+
+  pthread_mutex_t lock;
+  pthread_cond_t committed;
+
+  // sticky error once a commit fails and the files can't be trusted
+  int ec;
+
+  // a thread is writing a batch
+  int committing;
+
+  // messages waiting for the next commit in ordinal order
+  struct log_entry *pending_head;
+  struct log_entry *pending_tail;
+
+  // assigned to the next appended message
+  uint64_t next_ordinal;
+  uint64_t next_offset;
+
+  // every message before this ordinal is durable
+  uint64_t durable;
+
+  // only touched by the committing thread
+  struct iovec *iov;
+  size_t iov_cap;
+  uint8_t *index_buf;
+  size_t index_cap;
+};
+
+static void encode_le(uint64_t n, size_t size, uint8_t *buf) {
+  for (size_t i = 0; i < size; ++i) {
+    buf[i] = n % 256;
+    n /= 256;
+  }
+}
+
+static uint64_t decode_le(size_t size, const uint8_t *buf) {
+  uint64_t n = 0;
+  for (size_t i = size; i > 0; --i)
+    n = n * 256 + buf[i - 1];
+
+  return n;
+}
+
+static int preadn(int fd, void *buf, size_t nbytes, uint64_t offset) {
+  uint8_t *p = buf;
+  size_t nread = 0;
+  while (nread < nbytes) {
+    ssize_t ret = pread(fd, p + nread, nbytes - nread, offset + nread);
+    if (ret < 0) {
+      if (errno == EINTR)
+        continue;
+
+      return MSGSTREAM_SYS_READ_ERR;
+    }
+
+    if (ret == 0)
+      return nread ? MSGSTREAM_TRUNC : MSGSTREAM_EOF;
+
+    nread += ret;
+  }
+
+  return MSGSTREAM_OK;
+}
+
+static int sync_fd(int fd) {
+#ifdef __APPLE__
+  // fsync on macOS doesn't flush the drive's cache
+  if (fcntl(fd, F_FULLFSYNC) == 0)
+    return MSGSTREAM_OK;
+
+  return fsync(fd) == 0 ? MSGSTREAM_OK : MSGSTREAM_SYS_SYNC_ERR;
+#else
+  return fdatasync(fd) == 0 ? MSGSTREAM_OK : MSGSTREAM_SYS_SYNC_ERR;
+#endif
+}
+
+// Find the end of the frame at offset. *end is 0 if the frame runs past the
+// end of the log, meaning it was only partially written.
+static int frame_end(struct msgstream_log_ *log, uint64_t offset,
+                     uint64_t log_size, uint64_t *end) {
+  uint8_t hdr_buf[MSGSTREAM_HEADER_BUF_SIZE];
+  *end = 0;
+  if (offset + log->hdr_size > log_size)
+    return MSGSTREAM_OK;
+
+  int ec = preadn(log->log_fd, hdr_buf, log->hdr_size, offset);
+  if (ec)
+    return ec;
+
+  size_t msg_size;
+  if ((ec = msgstream_decode_header(hdr_buf, log->hdr_size, &msg_size)))
+    return ec;
+
+  if (msg_size > log->buf_size)
+    return MSGSTREAM_BIG_MSG;
+
+  uint64_t e = offset + log->hdr_size + msg_size;
+  if (e <= log_size)
+    *end = e;
+
+  return MSGSTREAM_OK;
+}
+
+static int read_index(struct msgstream_log_ *log, uint64_t i,
+                      uint64_t *offset) {
+  uint8_t entry[INDEX_ENTRY_SIZE];
+  int ec = preadn(log->index_fd, entry, INDEX_ENTRY_SIZE,
+                  i * INDEX_ENTRY_SIZE);
+  if (ec)
+    return ec;
+
+  *offset = decode_le(INDEX_ENTRY_SIZE, entry);
+  return MSGSTREAM_OK;
+}
+
+// Like frame_end, but for a frame an index entry points at. The index isn't
+// synced, so after a crash an entry can hold anything. A frame that doesn't
+// decode only means the entry can't be trusted, so *end is 0.
+static int indexed_frame_end(struct msgstream_log_ *log, uint64_t offset,
+                             uint64_t log_size, uint64_t *end) {
+  int ec = frame_end(log, offset, log_size, end);
+  if (ec == MSGSTREAM_SYS_READ_ERR)
+    return ec;
+
+  if (ec)
+    *end = 0;
+
+  return MSGSTREAM_OK;
+}
+
+// Set *end to the end of the frame index entry i - 1 points at, or 0 if the
+// entry doesn't start where the one before it ended. Entry 0 is always 0.
+static int check_index(struct msgstream_log_ *log, uint64_t i,
+                       uint64_t log_size, uint64_t *end) {
+  uint64_t offset, expect = 0;
+  int ec = read_index(log, i - 1, &offset);
+  if (!ec && i > 1 && !(ec = read_index(log, i - 2, &expect)))
+    ec = indexed_frame_end(log, expect, log_size, &expect);
+
+  if (ec)
+    return ec;
+
+  *end = 0;
+  if (offset != expect || (i > 1 && expect == 0))
+    return MSGSTREAM_OK;
+
+  return indexed_frame_end(log, offset, log_size, end);
+}
+
+static int recover(struct msgstream_log_ *log) {
+  struct stat log_st, index_st;
+  if (fstat(log->log_fd, &log_st) || fstat(log->index_fd, &index_st))
+    return MSGSTREAM_SYS_READ_ERR;
+
+  uint64_t log_size = log_st.st_size;
+  uint64_t n = index_st.st_size / INDEX_ENTRY_SIZE;
+
+  // the index isn't synced, so drop entries that don't follow the one before
+  // them or whose frames didn't make it
+  uint64_t end = 0;
+  while (n > 0) {
+    int ec = check_index(log, n, log_size, &end);
+    if (ec)
+      return ec;
+
+    if (end)
+      break;
+
+    --n;
+  }
+
+  // index frames past the last indexed one. Only a frame running past the end
+  // of the log is a torn write. Anything else that doesn't decode is left
+  // alone rather than truncating durable messages.
+  for (;;) {
+    uint64_t next_end;
+    int ec = frame_end(log, end, log_size, &next_end);
+    if (ec)
+      return ec;
+
+    if (!next_end)
+      break;
+
+    uint8_t entry[INDEX_ENTRY_SIZE];
+    encode_le(end, INDEX_ENTRY_SIZE, entry);
+    if (pwrite(log->index_fd, entry, INDEX_ENTRY_SIZE,
+               n * INDEX_ENTRY_SIZE) != INDEX_ENTRY_SIZE)
+      return MSGSTREAM_SYS_WRITE_ERR;
+
+    ++n;
+    end = next_end;
+  }
+
+  if (ftruncate(log->log_fd, end) ||
+      ftruncate(log->index_fd, n * INDEX_ENTRY_SIZE))
+    return MSGSTREAM_SYS_WRITE_ERR;
+
+  if (lseek(log->log_fd, end, SEEK_SET) < 0 ||
+      lseek(log->index_fd, n * INDEX_ENTRY_SIZE, SEEK_SET) < 0)
+    return MSGSTREAM_SYS_WRITE_ERR;
+
+  log->next_ordinal = log->durable = n;
+  log->next_offset = end;
+  return MSGSTREAM_OK;
+}
+
+int msgstream_log_open(int log_fd, int index_fd, size_t buf_size,
+                       msgstream_log *out) {
+  if (!out)
+    return MSGSTREAM_NULL_ARG;
+
+  struct msgstream_log_ *log = calloc(1, sizeof(struct msgstream_log_));
+  if (!log)
+    return MSGSTREAM_ALLOC;
+
+  int ec = msgstream_header_size(buf_size, &log->hdr_size);
+  if (ec) {
+    free(log);
+    return ec;
+  }
+
+  log->log_fd = log_fd;
+  log->index_fd = index_fd;
+  log->buf_size = buf_size;
+
+  ec = recover(log);
+  if (ec) {
+    free(log);
+    return ec;
+  }
+
+  if (pthread_mutex_init(&log->lock, NULL)) {
+    free(log);
+    return MSGSTREAM_ALLOC;
+  }
+
+  if (pthread_cond_init(&log->committed, NULL)) {
+    pthread_mutex_destroy(&log->lock);
+    free(log);
+    return MSGSTREAM_ALLOC;
+  }
+
+  *out = log;
+  return MSGSTREAM_OK;
+}
+
+void msgstream_log_close(msgstream_log log) {
+  if (!log)
+    return;
+
+  pthread_cond_destroy(&log->committed);
+  pthread_mutex_destroy(&log->lock);
+  free(log->iov);
+  free(log->index_buf);
+  free(log);
+}
+
+void msgstream_log_set_commit_window(msgstream_log log, uint64_t window_ns) {
+  if (!log)
+    return;
+
+  pthread_mutex_lock(&log->lock);
+  log->window_ns = window_ns;
+  pthread_mutex_unlock(&log->lock);
+}
+
+static int reserve(void **buf, size_t *cap, size_t n, size_t elem_size) {
+  if (n <= *cap)
+    return MSGSTREAM_OK;
+
+  size_t new_cap = *cap ? *cap : 64;
+  while (new_cap < n)
+    new_cap *= 2;
+
+  void *p = realloc(*buf, new_cap * elem_size);
+  if (!p)
+    return MSGSTREAM_ALLOC;
+
+  *buf = p;
+  *cap = new_cap;
+  return MSGSTREAM_OK;
+}
+
+// write a batch to the log, sync it, then index it. called without the lock
+static int commit(struct msgstream_log_ *log, struct log_entry *batch,
+                  size_t count) {
+  int ec = reserve((void **)&log->iov, &log->iov_cap, 2 * count,
+                   sizeof(struct iovec));
+  if (ec)
+    return ec;
+
+  ec = reserve((void **)&log->index_buf, &log->index_cap,
+               count * INDEX_ENTRY_SIZE, 1);
+  if (ec)
+    return ec;
+
+  int iovcnt = 0;
+  size_t i = 0;
+  for (struct log_entry *e = batch; e; e = e->next, ++i) {
+    log->iov[iovcnt].iov_base = e->hdr_buf;
+    log->iov[iovcnt++].iov_len = log->hdr_size;
+    if (e->msg_size > 0) {
+      log->iov[iovcnt].iov_base = (void *)e->buf;
+      log->iov[iovcnt++].iov_len = e->msg_size;
+    }
+
+    encode_le(e->offset, INDEX_ENTRY_SIZE,
+              log->index_buf + i * INDEX_ENTRY_SIZE);
+  }
+
+  for (int off = 0; off < iovcnt; off += IOV_MAX) {
+    int n = iovcnt - off < IOV_MAX ? iovcnt - off : IOV_MAX;
+    ec = msgstream_io_writevn(log->log_fd, log->iov + off, n);
+    if (ec)
+      return ec;
+  }
+
+  ec = sync_fd(log->log_fd);
+  if (ec)
+    return ec;
+
+  struct iovec index_iov;
+  index_iov.iov_base = log->index_buf;
+  index_iov.iov_len = count * INDEX_ENTRY_SIZE;
+  return msgstream_io_writevn(log->index_fd, &index_iov, 1);
+}
+
+static void wait_window(uint64_t window_ns) {
+  struct timespec ts;
+  ts.tv_sec = window_ns / 1000000000;
+  ts.tv_nsec = window_ns % 1000000000;
+  while (nanosleep(&ts, &ts) && errno == EINTR)
+    ;
+}
+
+int msgstream_log_append(msgstream_log log, const void *buf, size_t msg_size,
+                         uint64_t *ordinal) {
+  if (!(log && ordinal) || (!buf && msg_size > 0))
+    return MSGSTREAM_NULL_ARG;
+
+  if (msg_size > log->buf_size)
+    return MSGSTREAM_BIG_MSG;
+
+  struct log_entry entry;
+  entry.next = NULL;
+  entry.buf = buf;
+  entry.msg_size = msg_size;
+
+  int ec = msgstream_encode_header(msg_size, log->hdr_size, entry.hdr_buf);
+  if (ec)
+    return ec;
+
+  pthread_mutex_lock(&log->lock);
+  if (log->ec) {
+    ec = log->ec;
+    pthread_mutex_unlock(&log->lock);
+    return ec;
+  }
+
+  uint64_t ord = log->next_ordinal++;
+  entry.offset = log->next_offset;
+  log->next_offset += log->hdr_size + msg_size;
+
+  if (log->pending_tail)
+    log->pending_tail->next = &entry;
+  else
+    log->pending_head = &entry;
+
+  log->pending_tail = &entry;
+
+  while (log->durable <= ord && !log->ec) {
+    if (log->committing) {
+      pthread_cond_wait(&log->committed, &log->lock);
+      continue;
+    }
+
+    // lead a commit for everything pending, including other appenders
+    log->committing = 1;
+    if (log->window_ns) {
+      uint64_t window_ns = log->window_ns;
+      pthread_mutex_unlock(&log->lock);
+      wait_window(window_ns);
+      pthread_mutex_lock(&log->lock);
+    }
+
+    struct log_entry *batch = log->pending_head;
+    uint64_t batch_end = log->next_ordinal;
+    size_t count = batch_end - log->durable;
+    log->pending_head = log->pending_tail = NULL;
+    pthread_mutex_unlock(&log->lock);
+
+    int commit_ec = commit(log, batch, count);
+
+    pthread_mutex_lock(&log->lock);
+    if (commit_ec)
+      log->ec = commit_ec;
+    else
+      log->durable = batch_end;
+
+    log->committing = 0;
+    pthread_cond_broadcast(&log->committed);
+  }
+
+  ec = log->durable > ord ? MSGSTREAM_OK : log->ec;
+  pthread_mutex_unlock(&log->lock);
+
+  if (!ec)
+    *ordinal = ord;
+
+  return ec;
+}
+
+uint64_t msgstream_log_count(msgstream_log log) {
+  if (!log)
+    return 0;
+
+  pthread_mutex_lock(&log->lock);
+  uint64_t n = log->durable;
+  pthread_mutex_unlock(&log->lock);
+  return n;
+}
+
+int msgstream_log_offset(msgstream_log log, uint64_t ordinal,
+                         uint64_t *offset) {
+  if (!(log && offset))
+    return MSGSTREAM_NULL_ARG;
+
+  if (ordinal >= msgstream_log_count(log))
+    return MSGSTREAM_EOF;
+
+  uint8_t entry[INDEX_ENTRY_SIZE];
+  int ec = preadn(log->index_fd, entry, INDEX_ENTRY_SIZE,
+                  ordinal * INDEX_ENTRY_SIZE);
+  if (ec)
+    return ec == MSGSTREAM_EOF ? MSGSTREAM_TRUNC : ec;
+
+  *offset = decode_le(INDEX_ENTRY_SIZE, entry);
+  return MSGSTREAM_OK;
+}
+
+int msgstream_log_read(msgstream_log log, uint64_t ordinal, void *buf,
+                       size_t buf_size, size_t *msg_size) {
+  if (!(log && buf && msg_size))
+    return MSGSTREAM_NULL_ARG;
+
+  uint64_t offset;
+  int ec = msgstream_log_offset(log, ordinal, &offset);
+  if (ec)
+    return ec;
+
+  uint8_t hdr_buf[MSGSTREAM_HEADER_BUF_SIZE];
+  ec = preadn(log->log_fd, hdr_buf, log->hdr_size, offset);
+  if (ec)
+    return ec == MSGSTREAM_EOF ? MSGSTREAM_TRUNC : ec;
+
+  size_t size;
+  ec = msgstream_decode_header(hdr_buf, log->hdr_size, &size);
+  if (ec)
+    return ec;
+
+  if (size > buf_size)
+    return MSGSTREAM_BIG_MSG;
+
+  ec = preadn(log->log_fd, buf, size, offset + log->hdr_size);
+  if (ec)
+    return ec == MSGSTREAM_EOF ? MSGSTREAM_TRUNC : ec;
+
+  *msg_size = size;
+  return MSGSTREAM_OK;
+}
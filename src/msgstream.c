@@ -6,10 +6,13 @@
  * https://opensource.org/licenses/MIT.
  */
 #include "msgstream.h"
+#include "io.h"
+#include "trace.h"
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/errno.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 int msgstream_header_size(size_t buf_size, size_t *hdr_size) {
@@ -66,24 +69,85 @@ int msgstream_encode_header(size_t msg_size, size_t hdr_size, void *hdr_buf) {
   return MSGSTREAM_OK;
 }
 
-static int readn(int fd, void *buf, size_t nbytes) {
-  int expect_eof = 1;
-  size_t nread = 0;
-  while (nbytes > nread) {
-    ssize_t n = read(fd, buf + nread, nbytes - nread);
-    if (n == -1)
-      return MSGSTREAM_SYS_READ_ERR;
+size_t msgstream_varint_header_size(size_t msg_size) {
+  size_t n = 1;
+  while (msg_size >= 0x80) {
+    msg_size >>= 7;
+    n += 1;
+  }
+
+  return n;
+}
+
+int msgstream_varint_encode_header(size_t msg_size, void *hdr_buf,
+                                   size_t hdr_buf_size, size_t *hdr_size) {
+  if (!(hdr_buf && hdr_size))
+    return MSGSTREAM_NULL_ARG;
+  *hdr_size = 0;
+
+  uint8_t *buf = (uint8_t *)hdr_buf;
 
-    if (n == 0)
-      return expect_eof ? MSGSTREAM_EOF : MSGSTREAM_TRUNC;
+  // 7 bits at a time, least significant first. High bit means more follow.
+  size_t i = 0;
+  while (msg_size >= 0x80) {
+    if (i >= hdr_buf_size)
+      return MSGSTREAM_SMALL_BUF;
 
-    nread += n;
-    expect_eof = 0;
+    buf[i++] = (uint8_t)(msg_size | 0x80);
+    msg_size >>= 7;
   }
 
+  if (i >= hdr_buf_size)
+    return MSGSTREAM_SMALL_BUF;
+
+  buf[i++] = (uint8_t)msg_size;
+
+  *hdr_size = i;
   return MSGSTREAM_OK;
 }
 
+int msgstream_varint_decode_header(const void *hdr_buf, size_t hdr_buf_size,
+                                   size_t *hdr_size, size_t *msg_size) {
+  if (!(hdr_buf && hdr_size && msg_size))
+    return MSGSTREAM_NULL_ARG;
+
+  const uint8_t *buf = (const uint8_t *)hdr_buf;
+  const unsigned nbits = 8 * sizeof(size_t);
+
+  size_t msize = 0;
+  unsigned shift = 0;
+  for (size_t i = 0; i < hdr_buf_size; ++i) {
+    if (i >= MSGSTREAM_VARINT_HEADER_BUF_SIZE)
+      return MSGSTREAM_BIG_HDR;
+
+    size_t group = buf[i] & 0x7f;
+    if (shift < nbits) {
+      if ((group << shift) >> shift != group)
+        return MSGSTREAM_BIG_MSG;
+
+      msize |= group << shift;
+    } else if (group) {
+      return MSGSTREAM_BIG_MSG;
+    }
+
+    if (!(buf[i] & 0x80)) {
+      // the encoder never emits a trailing zero group. readers rely on a
+      // multi-byte header being followed by at least 128 payload bytes
+      if (i > 0 && buf[i] == 0)
+        return MSGSTREAM_HDR_SYNC;
+
+      *hdr_size = i + 1;
+      *msg_size = msize;
+      return MSGSTREAM_OK;
+    }
+
+    shift += 7;
+  }
+
+  return hdr_buf_size >= MSGSTREAM_VARINT_HEADER_BUF_SIZE ? MSGSTREAM_BIG_HDR
+                                                          : MSGSTREAM_SMALL_HDR;
+}
+
 int msgstream_decode_header(const void *header_buf, size_t header_size,
                             size_t *msg_size) {
   if (!(header_buf && msg_size))
@@ -111,8 +175,8 @@ int msgstream_decode_header(const void *header_buf, size_t header_size,
   return MSGSTREAM_OK;
 }
 
-int msgstream_fd_send(int fd, const void *buf, size_t buf_size,
-                      size_t msg_size) {
+static int fd_send(int fd, const void *buf, size_t buf_size,
+                   size_t msg_size) {
   int ec;
   size_t hdr_size;
   if ((ec = msgstream_header_size(buf_size, &hdr_size)))
@@ -122,17 +186,25 @@ int msgstream_fd_send(int fd, const void *buf, size_t buf_size,
   if ((ec = msgstream_encode_header(msg_size, hdr_size, hdr_buf)))
     return ec;
 
-  // TODO - one system call?
-  if (write(fd, hdr_buf, hdr_size) == -1)
-    return MSGSTREAM_SYS_WRITE_ERR;
+  struct iovec iov[2];
+  iov[0].iov_base = hdr_buf;
+  iov[0].iov_len = hdr_size;
+  iov[1].iov_base = (void *)buf;
+  iov[1].iov_len = msg_size;
 
-  if (write(fd, buf, msg_size) == -1)
-    return MSGSTREAM_SYS_WRITE_ERR;
+  if ((ec = msgstream_io_writevn(fd, iov, msg_size > 0 ? 2 : 1)))
+    return ec;
 
+  MSGSTREAM_TRACE_SEND_DONE(fd, msg_size);
   return MSGSTREAM_OK;
 }
 
-int msgstream_fd_recv(int fd, void *buf, size_t buf_size, size_t *msg_size) {
+int msgstream_fd_send(int fd, const void *buf, size_t buf_size,
+                      size_t msg_size) {
+  return msgstream_trace_ec(fd, fd_send(fd, buf, buf_size, msg_size));
+}
+
+static int fd_recv(int fd, void *buf, size_t buf_size, size_t *msg_size) {
   if (!msg_size)
     return MSGSTREAM_NULL_ARG;
   *msg_size = 0;
@@ -142,30 +214,107 @@ int msgstream_fd_recv(int fd, void *buf, size_t buf_size, size_t *msg_size) {
   if ((ec = msgstream_header_size(buf_size, &hdr_size)))
     return ec;
 
+  size_t nreads = 0;
   uint8_t hdr_buf[MSGSTREAM_HEADER_BUF_SIZE];
-  if ((ec = readn(fd, hdr_buf, hdr_size)))
+  if ((ec = msgstream_io_readn(fd, hdr_buf, hdr_size, &nreads)))
     return ec;
 
   size_t msize;
   if ((ec = msgstream_decode_header(hdr_buf, hdr_size, &msize)))
     return ec;
 
-  if ((ec = readn(fd, buf, msize))) {
+  MSGSTREAM_TRACE_HEADER(fd, hdr_size, msize);
+
+  if ((ec = msgstream_io_readn(fd, buf, msize, &nreads))) {
+    if (ec == MSGSTREAM_EOF)
+      return MSGSTREAM_TRUNC;
+
+    return ec;
+  }
+
+  MSGSTREAM_TRACE_RECV_DONE(fd, msize, nreads);
+
+  *msg_size = msize;
+  return MSGSTREAM_OK;
+}
+
+int msgstream_fd_recv(int fd, void *buf, size_t buf_size, size_t *msg_size) {
+  return msgstream_trace_ec(fd, fd_recv(fd, buf, buf_size, msg_size));
+}
+
+static int fd_varint_send(int fd, const void *buf, size_t msg_size) {
+  if (!buf && msg_size > 0)
+    return MSGSTREAM_NULL_ARG;
+
+  uint8_t hdr_buf[MSGSTREAM_VARINT_HEADER_BUF_SIZE];
+  size_t hdr_size;
+  int ec = msgstream_varint_encode_header(msg_size, hdr_buf, sizeof(hdr_buf),
+                                          &hdr_size);
+  if (ec)
+    return ec;
+
+  struct iovec iov[2];
+  iov[0].iov_base = hdr_buf;
+  iov[0].iov_len = hdr_size;
+  iov[1].iov_base = (void *)buf;
+  iov[1].iov_len = msg_size;
+
+  if ((ec = msgstream_io_writevn(fd, iov, msg_size > 0 ? 2 : 1)))
+    return ec;
+
+  MSGSTREAM_TRACE_SEND_DONE(fd, msg_size);
+  return MSGSTREAM_OK;
+}
+
+int msgstream_fd_varint_send(int fd, const void *buf, size_t msg_size) {
+  return msgstream_trace_ec(fd, fd_varint_send(fd, buf, msg_size));
+}
+
+static int fd_varint_recv(int fd, void *buf, size_t buf_size,
+                          size_t *msg_size) {
+  if (!msg_size)
+    return MSGSTREAM_NULL_ARG;
+  *msg_size = 0;
+
+  uint8_t hdr_buf[MSGSTREAM_VARINT_HEADER_BUF_SIZE];
+  size_t nreads = 0, hdr_size, msize, nread;
+  int ec;
+  if ((ec = msgstream_io_read_varint_header(fd, hdr_buf, &hdr_size, &msize,
+                                            &nread, &nreads)))
+    return ec;
+
+  MSGSTREAM_TRACE_HEADER(fd, hdr_size, msize);
+
+  if (msize > buf_size)
+    return MSGSTREAM_BIG_MSG;
+
+  const uint8_t *carry = hdr_buf + hdr_size;
+  size_t ncarry = nread - hdr_size;
+  if ((ec = msgstream_io_readn_carry(fd, buf, msize, &carry, &ncarry,
+                                    &nreads))) {
     if (ec == MSGSTREAM_EOF)
       return MSGSTREAM_TRUNC;
 
     return ec;
   }
 
+  MSGSTREAM_TRACE_RECV_DONE(fd, msize, nreads);
+
   *msg_size = msize;
   return MSGSTREAM_OK;
 }
 
+int msgstream_fd_varint_recv(int fd, void *buf, size_t buf_size,
+                             size_t *msg_size) {
+  return msgstream_trace_ec(fd, fd_varint_recv(fd, buf, buf_size, msg_size));
+}
+
 enum msg_read_stage { HEADER, MSG };
 
 struct msgstream_incremental_reader_ {
-  uint8_t hdr_buf[MSGSTREAM_HEADER_BUF_SIZE];
+  uint8_t hdr_buf[MSGSTREAM_VARINT_HEADER_BUF_SIZE];
   size_t hdr_size;
+  int varint;
 
   uint8_t *buf;
   size_t buf_size;
@@ -173,6 +322,7 @@ struct msgstream_incremental_reader_ {
 
   enum msg_read_stage stage;
   size_t nread;
+  size_t nreads;
 };
 
 msgstream_incremental_reader
@@ -188,7 +338,31 @@ msgstream_incremental_reader_alloc(void *buf, size_t buf_size) {
     free(reader);
     return NULL;
   }
-  memset(reader->hdr_buf, 0, MSGSTREAM_HEADER_BUF_SIZE);
+  memset(reader->hdr_buf, 0, sizeof(reader->hdr_buf));
+  reader->varint = 0;
+
+  reader->buf = buf;
+  reader->buf_size = buf_size;
+  reader->msg_size = 0;
+
+  reader->stage = HEADER;
+  reader->nread = 0;
+  reader->nreads = 0;
+
+  return reader;
+}
+
+msgstream_incremental_reader
+msgstream_varint_incremental_reader_alloc(void *buf, size_t buf_size) {
+  struct msgstream_incremental_reader_ *reader =
+      malloc(sizeof(struct msgstream_incremental_reader_));
+
+  if (!reader)
+    return NULL;
+
+  memset(reader->hdr_buf, 0, sizeof(reader->hdr_buf));
+  reader->hdr_size = 0;
+  reader->varint = 1;
 
   reader->buf = buf;
   reader->buf_size = buf_size;
@@ -196,6 +370,7 @@ msgstream_incremental_reader_alloc(void *buf, size_t buf_size) {
 
   reader->stage = HEADER;
   reader->nread = 0;
+  reader->nreads = 0;
 
   return reader;
 }
@@ -205,33 +380,12 @@ void msgstream_incremental_reader_free(msgstream_incremental_reader reader) {
     free(reader);
 }
 
-static int incremental_readn(int fd, size_t n, uint8_t *buf, size_t *pnread) {
-  size_t nread = *pnread;
-  if (nread >= n) {
-    return MSGSTREAM_OK;
-  }
-
-  size_t nleft = n - nread;
-  int nbytes = read(fd, buf + nread, nleft);
-  if (nbytes < 0) {
-    if (errno == EAGAIN)
-      return MSGSTREAM_OK;
-    else
-      return MSGSTREAM_SYS_READ_ERR;
-  } else if (nbytes == 0) {
-    if (nread == 0) {
-      return MSGSTREAM_EOF;
-    } else {
-      return MSGSTREAM_TRUNC;
-    }
-  } else {
-    *pnread = nread + nbytes;
-    return MSGSTREAM_OK;
-  }
+void *msgstream_io_incremental_reader_buf(msgstream_incremental_reader reader) {
+  return reader->buf;
 }
 
-int msgstream_fd_incremental_recv(int fd, msgstream_incremental_reader reader,
-                                  int *is_complete, size_t *pmsg_size) {
+static int fd_incremental_recv(int fd, msgstream_incremental_reader reader,
+                               int *is_complete, size_t *pmsg_size) {
   if (!(is_complete && reader && pmsg_size))
     return MSGSTREAM_NULL_ARG;
 
@@ -239,38 +393,43 @@ int msgstream_fd_incremental_recv(int fd, msgstream_incremental_reader reader,
   *pmsg_size = 0;
 
   if (reader->stage == HEADER) {
-    int ec = incremental_readn(fd, reader->hdr_size, reader->hdr_buf,
-                               &reader->nread);
-
-    if (ec == MSGSTREAM_OK) {
-      if (reader->nread == reader->hdr_size) {
-        ec = msgstream_decode_header(reader->hdr_buf, reader->hdr_size,
-                                     &reader->msg_size);
-        if (ec != MSGSTREAM_OK)
-          return ec;
-
-        reader->stage = MSG;
-        reader->nread = 0;
-
-        if (reader->msg_size == 0) {
-          *is_complete = 1;
-          *pmsg_size = 0;
-          reader->stage = HEADER;
-          return MSGSTREAM_OK;
-        }
-      } else if (reader->nread > 0) {
-        if (reader->hdr_buf[0] != reader->hdr_size) {
-          ec = MSGSTREAM_HDR_SYNC;
-        }
-      }
+    if (reader->nread == 0)
+      reader->nreads = 0;
+
+    int hdr_complete;
+    int ec = msgstream_io_incremental_header(
+        fd, reader->varint, reader->hdr_buf, &reader->hdr_size, &reader->nread,
+        &hdr_complete, &reader->msg_size, &reader->nreads);
+
+    if (ec != MSGSTREAM_OK || !hdr_complete)
+      return ec;
+
+    MSGSTREAM_TRACE_HEADER(fd, reader->hdr_size, reader->msg_size);
+
+    if (reader->varint && reader->msg_size > reader->buf_size)
+      return MSGSTREAM_BIG_MSG;
+
+    // payload bytes read along with a varint header
+    size_t ncarry = reader->nread - reader->hdr_size;
+    memcpy(reader->buf, reader->hdr_buf + reader->hdr_size, ncarry);
+
+    reader->stage = MSG;
+    reader->nread = ncarry;
+
+    if (reader->msg_size == 0) {
+      MSGSTREAM_TRACE_RECV_DONE(fd, 0, reader->nreads);
+      *is_complete = 1;
+      *pmsg_size = 0;
+      reader->stage = HEADER;
     }
 
-    return ec;
+    return MSGSTREAM_OK;
   } else {
-    int ec =
-        incremental_readn(fd, reader->msg_size, reader->buf, &reader->nread);
+    int ec = msgstream_io_incremental_readn(fd, reader->msg_size, reader->buf,
+                                            &reader->nread, &reader->nreads);
 
     if (reader->nread == reader->msg_size) {
+      MSGSTREAM_TRACE_RECV_DONE(fd, reader->msg_size, reader->nreads);
       *is_complete = 1;
       *pmsg_size = reader->msg_size;
 
@@ -282,3 +441,9 @@ int msgstream_fd_incremental_recv(int fd, msgstream_incremental_reader reader,
     return ec;
   }
 }
+
+int msgstream_fd_incremental_recv(int fd, msgstream_incremental_reader reader,
+                                  int *is_complete, size_t *pmsg_size) {
+  return msgstream_trace_ec(
+      fd, fd_incremental_recv(fd, reader, is_complete, pmsg_size));
+}
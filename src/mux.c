@@ -0,0 +1,601 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#include "msgstream/mux.h"
+#include "io.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// set on the final chunk of a message
+#define FLAG_FIN 0x01
+
+// frame header, channel and flags preceding a chunk's data
+#define CHUNK_HDR_BUF_SIZE (2 * MSGSTREAM_VARINT_HEADER_BUF_SIZE + 1)
+
+// chunks are read ahead into a buffer of this size so that a chunk's header
+// and data usually take a single read(). chunk data at least this big is
+// read directly into its channel.
+#define DEMUX_READ_BUF_SIZE (64 * 1024)
+
+struct queued_msg {
+  struct queued_msg *next;
+  const uint8_t *buf;
+  size_t msg_size;
+  size_t nsent;
+};
+
+struct mux_channel {
+  struct queued_msg *head;
+  struct queued_msg *tail;
+  size_t nqueued;
+  int priority;
+};
+
+// a chunk that the fd has only taken part of. it must be finished before any
+// other chunk is written or the stream is corrupted
+struct pending_chunk {
+  int active;
+  size_t channel;
+  uint8_t hdr_buf[CHUNK_HDR_BUF_SIZE];
+  size_t hdr_size;
+  size_t data_size;
+  int fin;
+
+  // bytes of the header and data written so far
+  size_t nwritten;
+};
+
+struct msgstream_mux_ {
+  int fd;
+  size_t chunk_size;
+  size_t nchannels;
+
+  // guards the channels and last so messages can be queued while another
+  // thread writes. only the writing thread touches chunk
+  pthread_mutex_t lock;
+
+  // most recently served channel, for round robin among equal priorities
+  size_t last;
+
+  struct pending_chunk chunk;
+
+  struct mux_channel channels[];
+};
+
+struct demux_channel {
+  uint8_t *buf;
+  size_t cap;
+  size_t len;
+};
+
+struct msgstream_demux_ {
+  size_t max_msg_size;
+  size_t nchannels;
+
+  // a channel whose message was returned and must be reset on the next recv
+  int has_done;
+  size_t done;
+
+  // bytes read from the fd but not yet parsed are rbuf[rstart, rend)
+  uint8_t *rbuf;
+  size_t rstart;
+  size_t rend;
+
+  // the chunk whose data is being copied into its channel
+  int in_chunk;
+  size_t chunk_channel;
+  size_t chunk_left;
+  int chunk_fin;
+
+  struct demux_channel channels[];
+};
+
+msgstream_mux msgstream_mux_alloc(int fd, size_t nchannels, size_t chunk_size) {
+  if (nchannels < 1 || chunk_size < 1)
+    return NULL;
+
+  struct msgstream_mux_ *mux =
+      calloc(1, sizeof(struct msgstream_mux_) +
+                    nchannels * sizeof(struct mux_channel));
+
+  if (!mux)
+    return NULL;
+
+  if (pthread_mutex_init(&mux->lock, NULL)) {
+    free(mux);
+    return NULL;
+  }
+
+  mux->fd = fd;
+  mux->chunk_size = chunk_size;
+  mux->nchannels = nchannels;
+  mux->last = nchannels - 1;
+  return mux;
+}
+
+void msgstream_mux_free(msgstream_mux mux) {
+  if (!mux)
+    return;
+
+  for (size_t i = 0; i < mux->nchannels; ++i) {
+    struct queued_msg *msg = mux->channels[i].head;
+    while (msg) {
+      struct queued_msg *next = msg->next;
+      free(msg);
+      msg = next;
+    }
+  }
+
+  pthread_mutex_destroy(&mux->lock);
+  free(mux);
+}
+
+int msgstream_mux_set_priority(msgstream_mux mux, unsigned channel,
+                               int priority) {
+  if (!mux)
+    return MSGSTREAM_NULL_ARG;
+
+  if (channel >= mux->nchannels)
+    return MSGSTREAM_BAD_CHANNEL;
+
+  pthread_mutex_lock(&mux->lock);
+  mux->channels[channel].priority = priority;
+  pthread_mutex_unlock(&mux->lock);
+  return MSGSTREAM_OK;
+}
+
+int msgstream_mux_send(msgstream_mux mux, unsigned channel, const void *buf,
+                       size_t msg_size) {
+  if (!mux || (!buf && msg_size > 0))
+    return MSGSTREAM_NULL_ARG;
+
+  if (channel >= mux->nchannels)
+    return MSGSTREAM_BAD_CHANNEL;
+
+  struct queued_msg *msg = malloc(sizeof(struct queued_msg));
+  if (!msg)
+    return MSGSTREAM_ALLOC;
+
+  msg->next = NULL;
+  msg->buf = buf;
+  msg->msg_size = msg_size;
+  msg->nsent = 0;
+
+  pthread_mutex_lock(&mux->lock);
+  struct mux_channel *ch = &mux->channels[channel];
+  if (ch->tail)
+    ch->tail->next = msg;
+  else
+    ch->head = msg;
+
+  ch->tail = msg;
+  ch->nqueued += 1;
+  pthread_mutex_unlock(&mux->lock);
+  return MSGSTREAM_OK;
+}
+
+// highest priority channel with a queued message, starting after the last
+// channel served so that equal priorities take turns
+static struct mux_channel *next_channel(msgstream_mux mux, size_t *channel) {
+  struct mux_channel *best = NULL;
+  for (size_t i = 1; i <= mux->nchannels; ++i) {
+    size_t c = (mux->last + i) % mux->nchannels;
+    struct mux_channel *ch = &mux->channels[c];
+    if (!ch->head)
+      continue;
+
+    if (!best || ch->priority > best->priority) {
+      best = ch;
+      *channel = c;
+    }
+  }
+
+  return best;
+}
+
+// frame the next chunk of the highest priority channel. called with the lock
+static int start_chunk(msgstream_mux mux, int *is_idle) {
+  size_t channel;
+  struct mux_channel *ch = next_channel(mux, &channel);
+  *is_idle = !ch;
+  if (!ch)
+    return MSGSTREAM_OK;
+
+  struct queued_msg *msg = ch->head;
+  size_t n = msg->msg_size - msg->nsent;
+  if (n > mux->chunk_size)
+    n = mux->chunk_size;
+
+  int fin = msg->nsent + n == msg->msg_size;
+
+  // frame header, then channel, then flags
+  uint8_t chan_buf[MSGSTREAM_VARINT_HEADER_BUF_SIZE];
+  size_t chan_size;
+  int ec = msgstream_varint_encode_header(channel, chan_buf, sizeof(chan_buf),
+                                          &chan_size);
+  if (ec)
+    return ec;
+
+  struct pending_chunk *chunk = &mux->chunk;
+  size_t hdr_size;
+  ec = msgstream_varint_encode_header(chan_size + 1 + n, chunk->hdr_buf,
+                                      MSGSTREAM_VARINT_HEADER_BUF_SIZE,
+                                      &hdr_size);
+  if (ec)
+    return ec;
+
+  memcpy(chunk->hdr_buf + hdr_size, chan_buf, chan_size);
+  hdr_size += chan_size;
+  chunk->hdr_buf[hdr_size++] = fin ? FLAG_FIN : 0;
+
+  chunk->active = 1;
+  chunk->channel = channel;
+  chunk->hdr_size = hdr_size;
+  chunk->data_size = n;
+  chunk->fin = fin;
+  chunk->nwritten = 0;
+  mux->last = channel;
+  return MSGSTREAM_OK;
+}
+
+// account for a fully written chunk. called with the lock
+static void finish_chunk(msgstream_mux mux) {
+  struct pending_chunk *chunk = &mux->chunk;
+  struct mux_channel *ch = &mux->channels[chunk->channel];
+  struct queued_msg *msg = ch->head;
+
+  chunk->active = 0;
+  msg->nsent += chunk->data_size;
+
+  if (chunk->fin) {
+    ch->head = msg->next;
+    if (!ch->head)
+      ch->tail = NULL;
+
+    ch->nqueued -= 1;
+    free(msg);
+  }
+}
+
+int msgstream_mux_write_chunk(msgstream_mux mux, int *is_idle,
+                              int *would_block) {
+  if (!(mux && is_idle && would_block))
+    return MSGSTREAM_NULL_ARG;
+
+  *is_idle = 0;
+  *would_block = 0;
+
+  struct pending_chunk *chunk = &mux->chunk;
+
+  pthread_mutex_lock(&mux->lock);
+  if (!chunk->active) {
+    int ec = start_chunk(mux, is_idle);
+    if (ec || *is_idle) {
+      pthread_mutex_unlock(&mux->lock);
+      return ec;
+    }
+  }
+
+  // the head can't change while its chunk is pending, so this stays valid
+  // after unlocking
+  struct queued_msg *msg = mux->channels[chunk->channel].head;
+  const uint8_t *data = msg->buf + msg->nsent;
+  pthread_mutex_unlock(&mux->lock);
+
+  // resume after whatever part of the header and data was already written
+  struct iovec iov[2];
+  int iovcnt = 0;
+  size_t skip = chunk->nwritten;
+  if (skip < chunk->hdr_size) {
+    iov[iovcnt].iov_base = chunk->hdr_buf + skip;
+    iov[iovcnt++].iov_len = chunk->hdr_size - skip;
+    skip = 0;
+  } else {
+    skip -= chunk->hdr_size;
+  }
+
+  if (chunk->data_size > skip) {
+    iov[iovcnt].iov_base = (void *)(data + skip);
+    iov[iovcnt++].iov_len = chunk->data_size - skip;
+  }
+
+  size_t n;
+  int ec = msgstream_io_writev_some(mux->fd, iov, iovcnt, &n);
+  chunk->nwritten += n;
+  if (ec)
+    return ec;
+
+  if (chunk->nwritten < chunk->hdr_size + chunk->data_size) {
+    *would_block = 1;
+    return MSGSTREAM_OK;
+  }
+
+  pthread_mutex_lock(&mux->lock);
+  finish_chunk(mux);
+  pthread_mutex_unlock(&mux->lock);
+  return MSGSTREAM_OK;
+}
+
+int msgstream_mux_flush(msgstream_mux mux) {
+  int is_idle = 0, would_block = 0, ec = MSGSTREAM_OK;
+  while (!ec && !is_idle && !would_block)
+    ec = msgstream_mux_write_chunk(mux, &is_idle, &would_block);
+
+  return ec;
+}
+
+size_t msgstream_mux_queued(msgstream_mux mux, unsigned channel) {
+  if (!mux || channel >= mux->nchannels)
+    return 0;
+
+  pthread_mutex_lock(&mux->lock);
+  size_t n = mux->channels[channel].nqueued;
+  pthread_mutex_unlock(&mux->lock);
+  return n;
+}
+
+msgstream_demux msgstream_demux_alloc(size_t nchannels, size_t max_msg_size) {
+  if (nchannels < 1)
+    return NULL;
+
+  struct msgstream_demux_ *demux =
+      calloc(1, sizeof(struct msgstream_demux_) +
+                    nchannels * sizeof(struct demux_channel));
+
+  if (!demux)
+    return NULL;
+
+  demux->rbuf = malloc(DEMUX_READ_BUF_SIZE);
+  if (!demux->rbuf) {
+    free(demux);
+    return NULL;
+  }
+
+  demux->max_msg_size = max_msg_size;
+  demux->nchannels = nchannels;
+  return demux;
+}
+
+void msgstream_demux_free(msgstream_demux demux) {
+  if (!demux)
+    return;
+
+  for (size_t i = 0; i < demux->nchannels; ++i)
+    free(demux->channels[i].buf);
+
+  free(demux->rbuf);
+  free(demux);
+}
+
+static int reserve(struct demux_channel *ch, size_t n, size_t max_msg_size) {
+  if (n > max_msg_size - ch->len)
+    return MSGSTREAM_BIG_MSG;
+
+  size_t need = ch->len + n;
+  if (need <= ch->cap)
+    return MSGSTREAM_OK;
+
+  size_t cap = ch->cap * 2;
+  if (cap < need)
+    cap = need;
+
+  if (cap > max_msg_size)
+    cap = max_msg_size;
+
+  uint8_t *buf = realloc(ch->buf, cap);
+  if (!buf)
+    return MSGSTREAM_ALLOC;
+
+  ch->buf = buf;
+  ch->cap = cap;
+  return MSGSTREAM_OK;
+}
+
+// start the chunk at the front of rbuf. MSGSTREAM_SMALL_HDR if more bytes are
+// needed to parse its header
+static int start_demux_chunk(msgstream_demux demux) {
+  const uint8_t *p = demux->rbuf + demux->rstart;
+  size_t avail = demux->rend - demux->rstart;
+
+  size_t hdr_size, frame_size;
+  int ec = msgstream_varint_decode_header(p, avail, &hdr_size, &frame_size);
+  if (ec)
+    return ec;
+
+  // the channel can't extend past the end of the frame
+  size_t chan_avail = avail - hdr_size;
+  if (chan_avail > frame_size)
+    chan_avail = frame_size;
+
+  size_t chan_size, chan;
+  ec = msgstream_varint_decode_header(p + hdr_size, chan_avail, &chan_size,
+                                      &chan);
+  if (ec == MSGSTREAM_SMALL_HDR && chan_avail == frame_size)
+    return MSGSTREAM_HDR_SYNC;
+
+  if (ec)
+    return ec;
+
+  if (frame_size == chan_size)
+    return MSGSTREAM_HDR_SYNC; // no flags
+
+  if (avail < hdr_size + chan_size + 1)
+    return MSGSTREAM_SMALL_HDR;
+
+  if (chan >= demux->nchannels)
+    return MSGSTREAM_BAD_CHANNEL;
+
+  struct demux_channel *ch = &demux->channels[chan];
+  size_t n = frame_size - chan_size - 1;
+  if ((ec = reserve(ch, n, demux->max_msg_size)))
+    return ec;
+
+  demux->in_chunk = 1;
+  demux->chunk_channel = chan;
+  demux->chunk_left = n;
+  demux->chunk_fin = p[hdr_size + chan_size] & FLAG_FIN;
+  demux->rstart += hdr_size + chan_size + 1;
+  return MSGSTREAM_OK;
+}
+
+// reassemble chunks from rbuf until a message is complete or more bytes are
+// needed
+static int parse_chunks(msgstream_demux demux, int *is_complete) {
+  *is_complete = 0;
+
+  for (;;) {
+    if (!demux->in_chunk) {
+      int ec = start_demux_chunk(demux);
+      if (ec == MSGSTREAM_SMALL_HDR)
+        return MSGSTREAM_OK;
+
+      if (ec)
+        return ec;
+    }
+
+    struct demux_channel *ch = &demux->channels[demux->chunk_channel];
+    size_t n = demux->rend - demux->rstart;
+    if (n > demux->chunk_left)
+      n = demux->chunk_left;
+
+    if (n > 0) {
+      memcpy(ch->buf + ch->len, demux->rbuf + demux->rstart, n);
+      ch->len += n;
+      demux->rstart += n;
+      demux->chunk_left -= n;
+    }
+
+    if (demux->chunk_left > 0)
+      return MSGSTREAM_OK;
+
+    demux->in_chunk = 0;
+    if (demux->chunk_fin) {
+      demux->has_done = 1;
+      demux->done = demux->chunk_channel;
+      *is_complete = 1;
+      return MSGSTREAM_OK;
+    }
+  }
+}
+
+// make a single read(), into the channel if the rest of a big chunk's data is
+// all that's left to read, or else into rbuf
+static int fill(int fd, msgstream_demux demux, int *would_block) {
+  *would_block = 0;
+
+  uint8_t *dst;
+  size_t cap;
+  int direct = demux->in_chunk && demux->rstart == demux->rend &&
+               demux->chunk_left >= DEMUX_READ_BUF_SIZE;
+  if (direct) {
+    struct demux_channel *ch = &demux->channels[demux->chunk_channel];
+    dst = ch->buf + ch->len;
+    cap = demux->chunk_left;
+  } else {
+    if (demux->rstart > 0) {
+      memmove(demux->rbuf, demux->rbuf + demux->rstart,
+              demux->rend - demux->rstart);
+      demux->rend -= demux->rstart;
+      demux->rstart = 0;
+    }
+
+    dst = demux->rbuf + demux->rend;
+    cap = DEMUX_READ_BUF_SIZE - demux->rend;
+  }
+
+  ssize_t n = read(fd, dst, cap);
+  if (n < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      *would_block = 1;
+      return MSGSTREAM_OK;
+    }
+
+    return MSGSTREAM_SYS_READ_ERR;
+  }
+
+  if (n == 0)
+    return demux->in_chunk || demux->rend > demux->rstart ? MSGSTREAM_TRUNC
+                                                          : MSGSTREAM_EOF;
+
+  if (direct) {
+    demux->channels[demux->chunk_channel].len += n;
+    demux->chunk_left -= n;
+  } else {
+    demux->rend += n;
+  }
+
+  return MSGSTREAM_OK;
+}
+
+static void take_message(msgstream_demux demux, unsigned *channel,
+                         const void **msg, size_t *msg_size) {
+  struct demux_channel *ch = &demux->channels[demux->done];
+  *channel = (unsigned)demux->done;
+  *msg = ch->buf;
+  *msg_size = ch->len;
+}
+
+static void reset_done(msgstream_demux demux) {
+  if (demux->has_done) {
+    demux->channels[demux->done].len = 0;
+    demux->has_done = 0;
+  }
+}
+
+int msgstream_demux_recv(int fd, msgstream_demux demux, unsigned *channel,
+                         const void **msg, size_t *msg_size) {
+  if (!(demux && channel && msg && msg_size))
+    return MSGSTREAM_NULL_ARG;
+
+  reset_done(demux);
+
+  for (;;) {
+    int is_complete, would_block;
+    int ec = parse_chunks(demux, &is_complete);
+    if (ec)
+      return ec;
+
+    if (is_complete) {
+      take_message(demux, channel, msg, msg_size);
+      return MSGSTREAM_OK;
+    }
+
+    if ((ec = fill(fd, demux, &would_block)))
+      return ec;
+
+    if (would_block)
+      return MSGSTREAM_SYS_READ_ERR;
+  }
+}
+
+int msgstream_demux_incremental_recv(int fd, msgstream_demux demux,
+                                     int *is_complete, unsigned *channel,
+                                     const void **msg, size_t *msg_size) {
+  if (!(demux && is_complete && channel && msg && msg_size))
+    return MSGSTREAM_NULL_ARG;
+
+  *is_complete = 0;
+  reset_done(demux);
+
+  // a message may already be buffered from an earlier read
+  int ec = parse_chunks(demux, is_complete);
+  if (!ec && !*is_complete) {
+    int would_block;
+    ec = fill(fd, demux, &would_block);
+    if (!(ec || would_block))
+      ec = parse_chunks(demux, is_complete);
+  }
+
+  if (!ec && *is_complete)
+    take_message(demux, channel, msg, msg_size);
+
+  return ec;
+}
@@ -0,0 +1,293 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#include "msgstream/pool.h"
+#include "io.h"
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// smallest buffer size class is 1 << MIN_CLASS_SHIFT bytes. the largest
+// class holds everything bigger than the class before it
+#define MIN_CLASS_SHIFT 6
+#define NUM_CLASSES (8 * sizeof(size_t) - MIN_CLASS_SHIFT)
+
+// number of readers allocated at once by msgstream_pooled_reader_alloc
+#define SLAB_NREADERS 64
+
+enum pooled_read_stage { HEADER, MSG, DONE };
+
+struct reader_slab {
+  struct reader_slab *next;
+  struct msgstream_pooled_reader readers[SLAB_NREADERS];
+};
+
+struct msgstream_reader_pool_ {
+  size_t buf_size;
+  size_t hdr_size;
+  int varint;
+
+  // idle buffers per size class, linked through their first bytes
+  void *free_bufs[NUM_CLASSES];
+  size_t nborrowed;
+
+  // idle slab readers, linked through their buf field
+  struct reader_slab *slabs;
+  struct msgstream_pooled_reader *free_readers;
+};
+
+static msgstream_reader_pool pool_alloc(size_t buf_size, int varint) {
+  struct msgstream_reader_pool_ *pool =
+      calloc(1, sizeof(struct msgstream_reader_pool_));
+
+  if (!pool)
+    return NULL;
+
+  if (!varint && msgstream_header_size(buf_size, &pool->hdr_size)) {
+    free(pool);
+    return NULL;
+  }
+
+  pool->buf_size = buf_size;
+  pool->varint = varint;
+  return pool;
+}
+
+msgstream_reader_pool msgstream_reader_pool_alloc(size_t buf_size) {
+  return pool_alloc(buf_size, 0);
+}
+
+msgstream_reader_pool msgstream_varint_reader_pool_alloc(size_t buf_size) {
+  return pool_alloc(buf_size, 1);
+}
+
+void msgstream_reader_pool_free(msgstream_reader_pool pool) {
+  if (!pool)
+    return;
+
+  msgstream_reader_pool_trim(pool);
+
+  struct reader_slab *slab = pool->slabs;
+  while (slab) {
+    struct reader_slab *next = slab->next;
+    free(slab);
+    slab = next;
+  }
+
+  free(pool);
+}
+
+void msgstream_reader_pool_trim(msgstream_reader_pool pool) {
+  if (!pool)
+    return;
+
+  for (size_t i = 0; i < NUM_CLASSES; ++i) {
+    void *buf = pool->free_bufs[i];
+    while (buf) {
+      void *next = *(void **)buf;
+      free(buf);
+      buf = next;
+    }
+
+    pool->free_bufs[i] = NULL;
+  }
+}
+
+size_t msgstream_reader_pool_buffers_in_use(msgstream_reader_pool pool) {
+  return pool ? pool->nborrowed : 0;
+}
+
+static size_t size_class(size_t msg_size) {
+  size_t cls = 0;
+  while (cls < NUM_CLASSES - 1 &&
+         ((size_t)1 << (cls + MIN_CLASS_SHIFT)) < msg_size)
+    ++cls;
+
+  return cls;
+}
+
+// every buffer in a class has the same capacity
+static size_t class_capacity(msgstream_reader_pool pool, size_t cls) {
+  size_t cap = (size_t)1 << (cls + MIN_CLASS_SHIFT);
+  if (cap > pool->buf_size || cls == NUM_CLASSES - 1)
+    cap = pool->buf_size;
+
+  if (cap < sizeof(void *))
+    cap = sizeof(void *);
+
+  return cap;
+}
+
+static void *borrow_buf(msgstream_reader_pool pool, size_t msg_size) {
+  size_t cls = size_class(msg_size);
+  void *buf = pool->free_bufs[cls];
+  if (buf) {
+    pool->free_bufs[cls] = *(void **)buf;
+  } else {
+    buf = malloc(class_capacity(pool, cls));
+    if (!buf)
+      return NULL;
+  }
+
+  pool->nborrowed += 1;
+  return buf;
+}
+
+static void return_buf(msgstream_reader_pool pool, void *buf,
+                       size_t msg_size) {
+  size_t cls = size_class(msg_size);
+  *(void **)buf = pool->free_bufs[cls];
+  pool->free_bufs[cls] = buf;
+  pool->nborrowed -= 1;
+}
+
+int msgstream_pooled_reader_init(struct msgstream_pooled_reader *reader,
+                                 msgstream_reader_pool pool) {
+  if (!(reader && pool))
+    return MSGSTREAM_NULL_ARG;
+
+  memset(reader, 0, sizeof(struct msgstream_pooled_reader));
+  reader->pool = pool;
+  reader->hdr_size = pool->hdr_size;
+  reader->stage = HEADER;
+  return MSGSTREAM_OK;
+}
+
+static void reset(struct msgstream_pooled_reader *reader) {
+  if (reader->buf) {
+    return_buf(reader->pool, reader->buf, reader->msg_size);
+    reader->buf = NULL;
+  }
+
+  reader->stage = HEADER;
+  reader->hdr_size = reader->pool->hdr_size;
+  reader->nread = 0;
+  reader->nreads = 0;
+}
+
+void msgstream_pooled_reader_release(struct msgstream_pooled_reader *reader) {
+  if (reader && reader->stage == DONE)
+    reset(reader);
+}
+
+void msgstream_pooled_reader_cleanup(struct msgstream_pooled_reader *reader) {
+  if (reader && reader->pool)
+    reset(reader);
+}
+
+struct msgstream_pooled_reader *
+msgstream_pooled_reader_alloc(msgstream_reader_pool pool) {
+  if (!pool)
+    return NULL;
+
+  if (!pool->free_readers) {
+    struct reader_slab *slab = malloc(sizeof(struct reader_slab));
+    if (!slab)
+      return NULL;
+
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+
+    for (size_t i = 0; i < SLAB_NREADERS; ++i) {
+      slab->readers[i].buf = pool->free_readers;
+      pool->free_readers = &slab->readers[i];
+    }
+  }
+
+  struct msgstream_pooled_reader *reader = pool->free_readers;
+  pool->free_readers = reader->buf;
+
+  msgstream_pooled_reader_init(reader, pool);
+  return reader;
+}
+
+void msgstream_pooled_reader_free(struct msgstream_pooled_reader *reader) {
+  if (!reader)
+    return;
+
+  msgstream_reader_pool pool = reader->pool;
+  msgstream_pooled_reader_cleanup(reader);
+
+  reader->buf = pool->free_readers;
+  pool->free_readers = reader;
+}
+
+static int fd_pooled_recv(int fd, struct msgstream_pooled_reader *reader,
+                          int *is_complete, void **msg, size_t *msg_size) {
+  if (!(reader && is_complete && msg && msg_size))
+    return MSGSTREAM_NULL_ARG;
+
+  *is_complete = 0;
+  *msg = NULL;
+  *msg_size = 0;
+
+  msgstream_reader_pool pool = reader->pool;
+
+  if (reader->stage == DONE)
+    reset(reader);
+
+  if (reader->stage == HEADER) {
+    // idle polls before the first header byte aren't part of the message
+    if (reader->nread == 0)
+      reader->nreads = 0;
+
+    int hdr_complete;
+    int ec = msgstream_io_incremental_header(
+        fd, pool->varint, reader->hdr_buf, &reader->hdr_size, &reader->nread,
+        &hdr_complete, &reader->msg_size, &reader->nreads);
+
+    if (ec != MSGSTREAM_OK || !hdr_complete)
+      return ec;
+
+    MSGSTREAM_TRACE_HEADER(fd, reader->hdr_size, reader->msg_size);
+
+    if (reader->msg_size > pool->buf_size)
+      return MSGSTREAM_BIG_MSG;
+
+    // payload bytes read along with a varint header
+    size_t ncarry = reader->nread - reader->hdr_size;
+    reader->nread = 0;
+
+    if (reader->msg_size == 0) {
+      MSGSTREAM_TRACE_RECV_DONE(fd, 0, reader->nreads);
+      *is_complete = 1;
+      reader->stage = DONE;
+      return MSGSTREAM_OK;
+    }
+
+    // only now that a message is in flight does the reader need memory
+    reader->buf = borrow_buf(pool, reader->msg_size);
+    if (!reader->buf)
+      return MSGSTREAM_ALLOC;
+
+    memcpy(reader->buf, reader->hdr_buf + reader->hdr_size, ncarry);
+    reader->nread = ncarry;
+
+    reader->stage = MSG;
+    return MSGSTREAM_OK;
+  }
+
+  int ec = msgstream_io_incremental_readn(fd, reader->msg_size, reader->buf,
+                                          &reader->nread, &reader->nreads);
+
+  if (reader->nread == reader->msg_size) {
+    MSGSTREAM_TRACE_RECV_DONE(fd, reader->msg_size, reader->nreads);
+    *is_complete = 1;
+    *msg = reader->buf;
+    *msg_size = reader->msg_size;
+    reader->stage = DONE;
+  }
+
+  return ec;
+}
+
+int msgstream_fd_pooled_recv(int fd, struct msgstream_pooled_reader *reader,
+                             int *is_complete, void **msg, size_t *msg_size) {
+  return msgstream_trace_ec(
+      fd, fd_pooled_recv(fd, reader, is_complete, msg, msg_size));
+}
@@ -0,0 +1,382 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#include "msgstream/shared.h"
+#include "trace.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+struct msgstream_shared_reader_ {
+  int fd;
+  size_t buf_size;
+  size_t hdr_size;
+  int varint;
+
+  // each read() returns one whole frame, so consumers need no lock
+  int packet;
+
+  // guards the read buffer shared by consumers of a byte stream
+  pthread_mutex_t lock;
+
+  // signaled when a consumer is done reading from the fd
+  pthread_cond_t filled;
+
+  // bytes read from a byte stream but not yet received, in [start, end).
+  // Only the one consumer that is filling reads into [end, cap), and it does
+  // so without the lock.
+  uint8_t *rbuf;
+  size_t rcap;
+  size_t rstart;
+  size_t rend;
+  int filling;
+
+  // sticky error once the byte stream can't be trusted
+  int ec;
+};
+
+// bounds on the read buffer for byte streams. Frames that don't fit are read
+// by one consumer directly into its buffer.
+#define MIN_READ_BUF_SIZE (64 * 1024)
+#define MAX_READ_BUF_SIZE (1024 * 1024)
+
+// a pipe's read end can't tell whether its writer uses O_DIRECT, so only
+// sockets are detected
+static int is_packet_fd(int fd) {
+  int type;
+  socklen_t len = sizeof(type);
+  if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len))
+    return 0;
+
+  return type == SOCK_SEQPACKET || type == SOCK_DGRAM;
+}
+
+static msgstream_shared_reader shared_reader_alloc(int fd, size_t buf_size,
+                                                   int varint) {
+  struct msgstream_shared_reader_ *reader =
+      malloc(sizeof(struct msgstream_shared_reader_));
+
+  if (!reader)
+    return NULL;
+
+  reader->hdr_size = 0;
+  if (!varint && msgstream_header_size(buf_size, &reader->hdr_size)) {
+    free(reader);
+    return NULL;
+  }
+
+  if (pthread_mutex_init(&reader->lock, NULL)) {
+    free(reader);
+    return NULL;
+  }
+
+  if (pthread_cond_init(&reader->filled, NULL)) {
+    pthread_mutex_destroy(&reader->lock);
+    free(reader);
+    return NULL;
+  }
+
+  // room for two of the biggest frames, so refills are rarely short of space
+  size_t hdr_cap = varint ? MSGSTREAM_VARINT_HEADER_BUF_SIZE : reader->hdr_size;
+  size_t rcap = buf_size < MAX_READ_BUF_SIZE ? 2 * (hdr_cap + buf_size)
+                                             : MAX_READ_BUF_SIZE;
+  if (rcap < MIN_READ_BUF_SIZE)
+    rcap = MIN_READ_BUF_SIZE;
+  else if (rcap > MAX_READ_BUF_SIZE)
+    rcap = MAX_READ_BUF_SIZE;
+
+  reader->rbuf = NULL;
+  reader->rcap = rcap;
+  reader->rstart = reader->rend = 0;
+  reader->filling = 0;
+
+  reader->fd = fd;
+  reader->buf_size = buf_size;
+  reader->varint = varint;
+  reader->packet = is_packet_fd(fd);
+  reader->ec = MSGSTREAM_OK;
+  return reader;
+}
+
+msgstream_shared_reader msgstream_shared_reader_alloc(int fd,
+                                                      size_t buf_size) {
+  return shared_reader_alloc(fd, buf_size, 0);
+}
+
+msgstream_shared_reader msgstream_varint_shared_reader_alloc(int fd,
+                                                             size_t buf_size) {
+  return shared_reader_alloc(fd, buf_size, 1);
+}
+
+void msgstream_shared_reader_free(msgstream_shared_reader reader) {
+  if (!reader)
+    return;
+
+  pthread_cond_destroy(&reader->filled);
+  pthread_mutex_destroy(&reader->lock);
+  free(reader->rbuf);
+  free(reader);
+}
+
+// receive a frame with one read(). a varint header shorter than the space
+// reserved for it leaves the start of the body in hdr_buf
+static int packet_recv(msgstream_shared_reader reader, void *buf,
+                       size_t buf_size, size_t *msg_size) {
+  uint8_t hdr_buf[MSGSTREAM_VARINT_HEADER_BUF_SIZE];
+  size_t hdr_cap = reader->varint ? sizeof(hdr_buf) : reader->hdr_size;
+
+  struct iovec iov[2];
+  iov[0].iov_base = hdr_buf;
+  iov[0].iov_len = hdr_cap;
+  iov[1].iov_base = buf;
+  iov[1].iov_len = buf_size;
+
+  ssize_t n;
+  do {
+    n = readv(reader->fd, iov, buf_size > 0 ? 2 : 1);
+  } while (n == -1 && errno == EINTR);
+
+  if (n == -1)
+    return MSGSTREAM_SYS_READ_ERR;
+
+  if (n == 0)
+    return MSGSTREAM_EOF;
+
+  size_t nhdr = (size_t)n < hdr_cap ? (size_t)n : hdr_cap;
+  size_t hdr_size = reader->hdr_size, size;
+  int ec;
+  if (reader->varint) {
+    ec = msgstream_varint_decode_header(hdr_buf, nhdr, &hdr_size, &size);
+  } else if (nhdr < hdr_size) {
+    ec = MSGSTREAM_TRUNC;
+  } else {
+    ec = msgstream_decode_header(hdr_buf, hdr_size, &size);
+  }
+
+  if (ec)
+    return ec == MSGSTREAM_SMALL_HDR ? MSGSTREAM_TRUNC : ec;
+
+  MSGSTREAM_TRACE_HEADER(reader->fd, hdr_size, size);
+
+  // the kernel already dropped whatever didn't fit
+  if (size > buf_size || size > reader->buf_size)
+    return MSGSTREAM_BIG_MSG;
+
+  // a frame split across packets
+  if ((size_t)n - hdr_size != size)
+    return MSGSTREAM_TRUNC;
+
+  size_t spill = nhdr - hdr_size;
+  if (spill > 0) {
+    memmove((uint8_t *)buf + spill, buf, size - spill);
+    memcpy(buf, hdr_buf + hdr_size, spill);
+  }
+
+  MSGSTREAM_TRACE_RECV_DONE(reader->fd, size, 1);
+  *msg_size = size;
+  return MSGSTREAM_OK;
+}
+
+int msgstream_shared_reader_set_packet(msgstream_shared_reader reader,
+                                       int packet) {
+  if (!reader)
+    return MSGSTREAM_NULL_ARG;
+
+  reader->packet = packet;
+  return MSGSTREAM_OK;
+}
+
+// one read(), retrying when a signal interrupts it
+static ssize_t read_restart(int fd, void *buf, size_t n, size_t *nreads) {
+  ssize_t ret;
+  do {
+    ret = read(fd, buf, n);
+    *nreads += 1;
+  } while (ret == -1 && errno == EINTR);
+
+  return ret;
+}
+
+// decode the header at the start of the buffered bytes. *hdr_size is 0 if
+// more bytes are needed.
+static int buffered_header(msgstream_shared_reader reader, size_t *hdr_size,
+                           size_t *msg_size) {
+  const uint8_t *p = reader->rbuf + reader->rstart;
+  size_t n = reader->rend - reader->rstart;
+  int ec;
+
+  *hdr_size = 0;
+  if (reader->varint) {
+    ec = msgstream_varint_decode_header(p, n, hdr_size, msg_size);
+    if (ec == MSGSTREAM_SMALL_HDR) {
+      *hdr_size = 0;
+      return MSGSTREAM_OK;
+    }
+  } else {
+    if (n < reader->hdr_size)
+      return MSGSTREAM_OK;
+
+    *hdr_size = reader->hdr_size;
+    ec = msgstream_decode_header(p, *hdr_size, msg_size);
+  }
+
+  if (ec)
+    return ec;
+
+  MSGSTREAM_TRACE_HEADER(reader->fd, *hdr_size, *msg_size);
+  return *msg_size > reader->buf_size ? MSGSTREAM_BIG_MSG : MSGSTREAM_OK;
+}
+
+// Refill the read buffer with one read() while the lock is released. Called
+// with the lock held and no other consumer filling.
+static int fill(msgstream_shared_reader reader, size_t *nreads) {
+  if (reader->rstart > 0) {
+    memmove(reader->rbuf, reader->rbuf + reader->rstart,
+            reader->rend - reader->rstart);
+    reader->rend -= reader->rstart;
+    reader->rstart = 0;
+  }
+
+  reader->filling = 1;
+  pthread_mutex_unlock(&reader->lock);
+
+  ssize_t n = read_restart(reader->fd, reader->rbuf + reader->rend,
+                           reader->rcap - reader->rend, nreads);
+
+  pthread_mutex_lock(&reader->lock);
+  reader->filling = 0;
+  pthread_cond_broadcast(&reader->filled);
+
+  if (n == -1)
+    return MSGSTREAM_SYS_READ_ERR;
+
+  if (n == 0)
+    return reader->rend > 0 ? MSGSTREAM_TRUNC : MSGSTREAM_EOF;
+
+  reader->rend += n;
+  return MSGSTREAM_OK;
+}
+
+// Receive a frame too big for the read buffer by reading the rest of its body
+// straight from the fd while the lock is released. Called with the lock held,
+// no other consumer filling, and the frame's header buffered.
+static int recv_direct(msgstream_shared_reader reader, size_t hdr_size,
+                       size_t size, void *buf, size_t buf_size,
+                       size_t *nreads) {
+  int fits = size <= buf_size;
+  size_t have = reader->rend - reader->rstart - hdr_size;
+  if (fits)
+    memcpy(buf, reader->rbuf + reader->rstart + hdr_size, have);
+
+  reader->rstart = reader->rend = 0;
+  reader->filling = 1;
+  pthread_mutex_unlock(&reader->lock);
+
+  int ec = MSGSTREAM_OK;
+  uint8_t scratch[4096];
+  while (!ec && have < size) {
+    uint8_t *p = scratch;
+    size_t want = size - have;
+    if (fits)
+      p = (uint8_t *)buf + have;
+    else if (want > sizeof(scratch))
+      want = sizeof(scratch);
+
+    ssize_t n = read_restart(reader->fd, p, want, nreads);
+    if (n == -1)
+      ec = MSGSTREAM_SYS_READ_ERR;
+    else if (n == 0)
+      ec = MSGSTREAM_TRUNC;
+    else
+      have += n;
+  }
+
+  pthread_mutex_lock(&reader->lock);
+  reader->filling = 0;
+  pthread_cond_broadcast(&reader->filled);
+
+  if (!ec && !fits)
+    return MSGSTREAM_BIG_MSG;
+
+  return ec;
+}
+
+// Frames are copied out of a read buffer shared by all consumers. The lock is
+// only held while copying. One consumer at a time refills the buffer without
+// the lock, usually reading many frames with one read().
+static int stream_recv(msgstream_shared_reader reader, void *buf,
+                       size_t buf_size, size_t *msg_size) {
+  size_t nreads = 0, hdr_size = 0, size = 0;
+
+  pthread_mutex_lock(&reader->lock);
+
+  int ec = reader->ec;
+  if (!ec && !reader->rbuf && !(reader->rbuf = malloc(reader->rcap)))
+    ec = MSGSTREAM_ALLOC;
+
+  while (!ec) {
+    if ((ec = buffered_header(reader, &hdr_size, &size))) {
+      reader->ec = ec;
+      break;
+    }
+
+    size_t nbuffered = reader->rend - reader->rstart;
+    if (hdr_size && nbuffered - hdr_size >= size) {
+      if (size <= buf_size)
+        memcpy(buf, reader->rbuf + reader->rstart + hdr_size, size);
+      else
+        ec = MSGSTREAM_BIG_MSG;
+
+      reader->rstart += hdr_size + size;
+      break;
+    }
+
+    if (reader->filling) {
+      pthread_cond_wait(&reader->filled, &reader->lock);
+      ec = reader->ec;
+      continue;
+    }
+
+    if (hdr_size && hdr_size + size > reader->rcap) {
+      ec = recv_direct(reader, hdr_size, size, buf, buf_size, &nreads);
+      if (ec && ec != MSGSTREAM_BIG_MSG)
+        reader->ec = ec;
+
+      break;
+    }
+
+    if ((ec = fill(reader, &nreads)))
+      reader->ec = ec;
+  }
+
+  pthread_mutex_unlock(&reader->lock);
+
+  if (ec)
+    return ec;
+
+  MSGSTREAM_TRACE_RECV_DONE(reader->fd, size, nreads);
+  *msg_size = size;
+  return MSGSTREAM_OK;
+}
+
+int msgstream_shared_recv(msgstream_shared_reader reader, void *buf,
+                          size_t buf_size, size_t *msg_size) {
+  if (!(reader && msg_size) || (!buf && buf_size > 0))
+    return MSGSTREAM_NULL_ARG;
+
+  *msg_size = 0;
+
+  int ec = reader->packet ? packet_recv(reader, buf, buf_size, msg_size)
+                          : stream_recv(reader, buf, buf_size, msg_size);
+
+  return msgstream_trace_ec(reader->fd, ec);
+}
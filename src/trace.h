@@ -0,0 +1,118 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#ifndef MSGSTREAM_TRACE_H
+#define MSGSTREAM_TRACE_H
+
+/*
+ * Static tracepoints for the send/recv paths. On x86_64 and aarch64 Linux,
+ * these are USDT probes under the "msgstream" provider which compile to a NOP
+ * until a tracer such as bpftrace or perf attaches, e.g.
+ *
+ *   bpftrace -e 'usdt:./libmsgstream.so:msgstream:recv_done
+ *     { @reads = hist(arg2); }'
+ *
+ * The probes are emitted directly rather than through systemtap's <sys/sdt.h>
+ * so that they don't depend on systemtap-sdt-dev being installed where the
+ * library is built. Each probe site is a NOP plus a .note.stapsdt entry in the
+ * format sys/sdt.h produces. Every argument is passed as a signed 64 bit
+ * integer. script/check-probes.sh verifies that a build contains them all.
+ *
+ * Define MSGSTREAM_NO_TRACE to compile them out entirely.
+ */
+
+#include <sys/errno.h>
+
+#if !defined(MSGSTREAM_NO_TRACE) && defined(__linux__) &&                      \
+    (defined(__x86_64__) || defined(__aarch64__))
+#define MSGSTREAM_HAVE_SDT 1
+#endif
+
+#ifdef MSGSTREAM_HAVE_SDT
+// a NOP at the probe site and a stapsdt note locating it. _.stapsdt.base lets
+// tracers account for prelink adjusting the note's absolute addresses
+#define MSGSTREAM_SDT_ASM(name, args)                                          \
+  "990: nop\n"                                                                 \
+  ".pushsection .note.stapsdt,\"\",\"note\"\n"                                 \
+  ".balign 4\n"                                                                \
+  ".4byte 992f-991f, 994f-993f, 3\n"                                           \
+  "991: .asciz \"stapsdt\"\n"                                                  \
+  "992: .balign 4\n"                                                           \
+  "993: .8byte 990b\n"                                                         \
+  ".8byte _.stapsdt.base\n"                                                    \
+  ".8byte 0\n"                                                                 \
+  ".asciz \"msgstream\"\n"                                                     \
+  ".asciz \"" #name "\"\n"                                                     \
+  ".asciz \"" args "\"\n"                                                      \
+  "994: .balign 4\n"                                                           \
+  ".popsection\n"                                                              \
+  ".ifndef _.stapsdt.base\n"                                                   \
+  ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n"      \
+  ".weak _.stapsdt.base\n"                                                     \
+  ".hidden _.stapsdt.base\n"                                                   \
+  "_.stapsdt.base: .space 1\n"                                                 \
+  ".size _.stapsdt.base, 1\n"                                                  \
+  ".popsection\n"                                                              \
+  ".endif\n"
+
+#define MSGSTREAM_SDT_ARG(n, x) [a##n] "nor"((long long)(x))
+
+#define MSGSTREAM_PROBE1(name, a)                                              \
+  __asm__ volatile(MSGSTREAM_SDT_ASM(name, "-8@%[a1]")                         \
+                   : : MSGSTREAM_SDT_ARG(1, a))
+#define MSGSTREAM_PROBE2(name, a, b)                                           \
+  __asm__ volatile(MSGSTREAM_SDT_ASM(name, "-8@%[a1] -8@%[a2]")                \
+                   : : MSGSTREAM_SDT_ARG(1, a), MSGSTREAM_SDT_ARG(2, b))
+#define MSGSTREAM_PROBE3(name, a, b, c)                                        \
+  __asm__ volatile(MSGSTREAM_SDT_ASM(name, "-8@%[a1] -8@%[a2] -8@%[a3]")       \
+                   : : MSGSTREAM_SDT_ARG(1, a), MSGSTREAM_SDT_ARG(2, b),       \
+                     MSGSTREAM_SDT_ARG(3, c))
+#else
+#define MSGSTREAM_PROBE1(name, a) ((void)(a))
+#define MSGSTREAM_PROBE2(name, a, b) ((void)(a), (void)(b))
+#define MSGSTREAM_PROBE3(name, a, b, c) ((void)(a), (void)(b), (void)(c))
+#endif
+
+/** A message header was decoded: fd, header size, message size */
+#define MSGSTREAM_TRACE_HEADER(fd, hdr_size, msg_size)                         \
+  MSGSTREAM_PROBE3(header, fd, hdr_size, msg_size)
+
+/**
+ * A message was fully received: fd, message size, read() calls it took
+ * counting from the one that returned the first header byte
+ */
+#define MSGSTREAM_TRACE_RECV_DONE(fd, msg_size, nreads)                        \
+  MSGSTREAM_PROBE3(recv_done, fd, msg_size, nreads)
+
+/** A message was fully sent: fd, message size */
+#define MSGSTREAM_TRACE_SEND_DONE(fd, msg_size)                                \
+  MSGSTREAM_PROBE2(send_done, fd, msg_size)
+
+/** read() returned fewer bytes than requested: fd, bytes read, bytes wanted */
+#define MSGSTREAM_TRACE_READ_PARTIAL(fd, n, nwant)                             \
+  MSGSTREAM_PROBE3(read_partial, fd, n, nwant)
+
+/** write() accepted fewer bytes than given: fd, bytes written, bytes given */
+#define MSGSTREAM_TRACE_WRITE_PARTIAL(fd, n, nwant)                            \
+  MSGSTREAM_PROBE3(write_partial, fd, n, nwant)
+
+/** A non-blocking read had no data available: fd */
+#define MSGSTREAM_TRACE_EAGAIN(fd) MSGSTREAM_PROBE1(eagain, fd)
+
+/** A send/recv call is returning an error: fd, error code, errno */
+#define MSGSTREAM_TRACE_ERROR(fd, ec, err)                                     \
+  MSGSTREAM_PROBE3(error, fd, ec, err)
+
+/** Fire the error probe if ec is an error, passing ec through */
+static inline int msgstream_trace_ec(int fd, int ec) {
+  if (ec)
+    MSGSTREAM_TRACE_ERROR(fd, ec, errno);
+
+  return ec;
+}
+
+#endif
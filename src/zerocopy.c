@@ -0,0 +1,304 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#define _GNU_SOURCE // MSG_ZEROCOPY, MSG_MORE
+#include "msgstream/zerocopy.h"
+#include "io.h"
+#include "trace.h"
+
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/errno.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/errqueue.h> // needs struct timespec from time.h
+#include <netinet/in.h>
+#endif
+
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY) &&                           \
+    defined(SO_EE_ORIGIN_ZEROCOPY)
+#define HAVE_ZEROCOPY 1
+#endif
+
+struct completed_range {
+  uint64_t lo;
+  uint64_t hi;
+};
+
+struct msgstream_zerocopy_ {
+  int fd;
+  size_t threshold;
+  int enabled;
+
+  // successful MSG_ZEROCOPY send() calls. The kernel numbers these from 0
+  // with a 32 bit counter that wraps.
+  uint64_t nsent;
+
+  // every zero copy send numbered below this has completed
+  uint64_t ncompleted;
+
+  // sorted, disjoint [lo, hi) ranges of sends completed above ncompleted.
+  // The kernel doesn't promise to report completions in order.
+  struct completed_range *ranges;
+  size_t nranges;
+  size_t ranges_cap;
+
+  uint64_t ncopied;
+};
+
+msgstream_zerocopy msgstream_zerocopy_alloc(int fd, size_t threshold) {
+  struct msgstream_zerocopy_ *zc =
+      calloc(1, sizeof(struct msgstream_zerocopy_));
+  if (!zc)
+    return NULL;
+
+  zc->fd = fd;
+  zc->threshold = threshold;
+
+#ifdef HAVE_ZEROCOPY
+  // Completion ids count every MSG_ZEROCOPY send over the socket's lifetime,
+  // but there's no way to ask where the count is. If SO_ZEROCOPY is already
+  // on, an earlier sender may have used ids, so this one copies instead.
+  int on = 0;
+  socklen_t len = sizeof(on);
+  if (getsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, &len) == 0 && !on) {
+    int one = 1;
+    zc->enabled =
+        setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+  }
+#endif
+
+  return zc;
+}
+
+void msgstream_zerocopy_free(msgstream_zerocopy zc) {
+  if (!zc)
+    return;
+
+  free(zc->ranges);
+  free(zc);
+}
+
+int msgstream_zerocopy_enabled(msgstream_zerocopy zc) {
+  return zc ? zc->enabled : 0;
+}
+
+uint64_t msgstream_zerocopy_copied(msgstream_zerocopy zc) {
+  return zc ? zc->ncopied : 0;
+}
+
+#ifdef HAVE_ZEROCOPY
+static int send_all(msgstream_zerocopy zc, const uint8_t *buf, size_t n,
+                    int flags) {
+  while (n > 0) {
+    ssize_t nsent = send(zc->fd, buf, n, flags);
+    if (nsent == -1) {
+      if (errno == EINTR)
+        continue;
+
+      // out of pinned memory budget, so copy the rest instead
+      if (errno == ENOBUFS && (flags & MSG_ZEROCOPY)) {
+        flags &= ~MSG_ZEROCOPY;
+        continue;
+      }
+
+      return MSGSTREAM_SYS_WRITE_ERR;
+    }
+
+    if (flags & MSG_ZEROCOPY)
+      zc->nsent += 1;
+
+    if ((size_t)nsent < n)
+      MSGSTREAM_TRACE_WRITE_PARTIAL(zc->fd, nsent, n);
+
+    buf += nsent;
+    n -= nsent;
+  }
+
+  return MSGSTREAM_OK;
+}
+
+// the error queue also carries other cmsgs, e.g. timestamps
+static int is_recverr(const struct cmsghdr *cm) {
+  return (cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+         (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR);
+}
+
+// widen a 32 bit send id relative to what we know we've sent
+static uint64_t widen(msgstream_zerocopy zc, uint32_t id) {
+  return zc->nsent - (uint32_t)((uint32_t)zc->nsent - id);
+}
+
+static int add_completed(msgstream_zerocopy zc, uint64_t lo, uint64_t hi) {
+  if (hi <= zc->ncompleted)
+    return MSGSTREAM_OK;
+
+  if (lo < zc->ncompleted)
+    lo = zc->ncompleted;
+
+  // merge with every range it touches
+  size_t i = 0;
+  while (i < zc->nranges && zc->ranges[i].hi < lo)
+    ++i;
+
+  size_t j = i;
+  while (j < zc->nranges && zc->ranges[j].lo <= hi) {
+    if (zc->ranges[j].lo < lo)
+      lo = zc->ranges[j].lo;
+    if (zc->ranges[j].hi > hi)
+      hi = zc->ranges[j].hi;
+    ++j;
+  }
+
+  if (i == j) {
+    if (zc->nranges == zc->ranges_cap) {
+      size_t cap = zc->ranges_cap ? 2 * zc->ranges_cap : 8;
+      struct completed_range *ranges =
+          realloc(zc->ranges, cap * sizeof(struct completed_range));
+      if (!ranges)
+        return MSGSTREAM_ALLOC;
+
+      zc->ranges = ranges;
+      zc->ranges_cap = cap;
+    }
+
+    memmove(&zc->ranges[i + 1], &zc->ranges[i],
+            (zc->nranges - i) * sizeof(struct completed_range));
+    zc->nranges += 1;
+  } else if (j > i + 1) {
+    memmove(&zc->ranges[i + 1], &zc->ranges[j],
+            (zc->nranges - j) * sizeof(struct completed_range));
+    zc->nranges -= j - i - 1;
+  }
+
+  zc->ranges[i].lo = lo;
+  zc->ranges[i].hi = hi;
+
+  if (zc->ranges[0].lo == zc->ncompleted) {
+    zc->ncompleted = zc->ranges[0].hi;
+    memmove(&zc->ranges[0], &zc->ranges[1],
+            (zc->nranges - 1) * sizeof(struct completed_range));
+    zc->nranges -= 1;
+  }
+
+  return MSGSTREAM_OK;
+}
+
+static int read_completions(msgstream_zerocopy zc) {
+  for (;;) {
+    char control[CMSG_SPACE(sizeof(struct sock_extended_err) +
+                            sizeof(struct sockaddr_storage))];
+    struct msghdr msg = {0};
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if (recvmsg(zc->fd, &msg, MSG_ERRQUEUE) == -1) {
+      if (errno == EAGAIN)
+        return MSGSTREAM_OK;
+
+      if (errno == EINTR)
+        continue;
+
+      return MSGSTREAM_SYS_READ_ERR;
+    }
+
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm;
+         cm = CMSG_NXTHDR(&msg, cm)) {
+      if (!is_recverr(cm))
+        continue;
+
+      struct sock_extended_err *serr = (void *)CMSG_DATA(cm);
+      if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0)
+        continue;
+
+      // [ee_info, ee_data] is the range of completed sends
+      uint32_t lo = serr->ee_info, hi = serr->ee_data;
+      if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+        zc->ncopied += (uint32_t)(hi - lo) + 1;
+
+      int ec = add_completed(zc, widen(zc, lo), widen(zc, hi) + 1);
+      if (ec)
+        return ec;
+    }
+  }
+}
+#endif
+
+int msgstream_zerocopy_send(msgstream_zerocopy zc, const void *buf,
+                            size_t buf_size, size_t msg_size,
+                            uint64_t *ticket) {
+  if (!(zc && ticket))
+    return MSGSTREAM_NULL_ARG;
+
+  *ticket = 0;
+
+#ifdef HAVE_ZEROCOPY
+  if (zc->enabled && msg_size >= zc->threshold && msg_size > 0) {
+    int ec;
+    size_t hdr_size;
+    if ((ec = msgstream_header_size(buf_size, &hdr_size)))
+      return msgstream_trace_ec(zc->fd, ec);
+
+    uint8_t hdr_buf[MSGSTREAM_HEADER_BUF_SIZE];
+    if ((ec = msgstream_encode_header(msg_size, hdr_size, hdr_buf)))
+      return msgstream_trace_ec(zc->fd, ec);
+
+    // the header lives on the stack, so it can't be pinned for the kernel
+    if ((ec = send_all(zc, hdr_buf, hdr_size, MSG_MORE)))
+      return msgstream_trace_ec(zc->fd, ec);
+
+    if ((ec = send_all(zc, buf, msg_size, MSG_ZEROCOPY)))
+      return msgstream_trace_ec(zc->fd, ec);
+
+    MSGSTREAM_TRACE_SEND_DONE(zc->fd, msg_size);
+    *ticket = zc->nsent;
+    return MSGSTREAM_OK;
+  }
+#endif
+
+  return msgstream_fd_send(zc->fd, buf, buf_size, msg_size);
+}
+
+int msgstream_zerocopy_done(msgstream_zerocopy zc, uint64_t ticket,
+                            int *is_done) {
+  if (!(zc && is_done))
+    return MSGSTREAM_NULL_ARG;
+
+  *is_done = 0;
+
+#ifdef HAVE_ZEROCOPY
+  if (zc->ncompleted < ticket) {
+    int ec = read_completions(zc);
+    if (ec)
+      return ec;
+  }
+#endif
+
+  *is_done = zc->ncompleted >= ticket;
+  return MSGSTREAM_OK;
+}
+
+int msgstream_zerocopy_wait(msgstream_zerocopy zc, uint64_t ticket) {
+  int is_done = 0;
+  for (;;) {
+    int ec = msgstream_zerocopy_done(zc, ticket, &is_done);
+    if (ec || is_done)
+      return ec;
+
+    // completions on the error queue are signaled as POLLERR
+    struct pollfd pfd;
+    pfd.fd = zc->fd;
+    pfd.events = 0;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, -1) == -1 && errno != EINTR)
+      return MSGSTREAM_SYS_READ_ERR;
+  }
+}
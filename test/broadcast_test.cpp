@@ -0,0 +1,301 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#include <gtest/gtest.h>
+
+#include "msgstream/broadcast.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string_view>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+
+// when not negative, splice() fails after moving this many more bytes
+static std::atomic<long> splice_budget = -1;
+
+// replaces libc's splice() for the whole test binary to inject failures
+extern "C" ssize_t splice(int fd_in, loff_t *off_in, int fd_out,
+                          loff_t *off_out, size_t len, unsigned int flags) {
+  long budget = splice_budget;
+  if (budget == 0) {
+    errno = EIO;
+    return -1;
+  }
+
+  if (budget > 0)
+    len = std::min(len, (size_t)budget);
+
+  ssize_t n = syscall(SYS_splice, fd_in, off_in, fd_out, off_out, len, flags);
+  if (budget > 0 && n > 0)
+    splice_budget = budget - n;
+
+  return n;
+}
+#endif
+
+class broadcast : public testing::Test {
+protected:
+  static constexpr size_t nsubs = 3;
+  static constexpr size_t buf_size = 0x10000;
+
+  void SetUp() override {
+    for (size_t i = 0; i < nsubs; ++i) {
+      int fds[2];
+      if (pipe(fds) == -1) {
+        perror("pipe");
+        ADD_FAILURE() << "Failed to allocate pipe";
+      }
+
+      read_[i] = fds[0];
+      write_[i] = fds[1];
+      fcntl(write_[i], F_SETFL, O_NONBLOCK);
+    }
+  }
+
+  void TearDown() override {
+    for (size_t i = 0; i < nsubs; ++i) {
+      close(read_[i]);
+      close(write_[i]);
+    }
+  }
+
+  // shrink a subscriber's pipe so it falls behind
+  bool make_slow(size_t i) {
+#ifdef F_SETPIPE_SZ
+    return fcntl(write_[i], F_SETPIPE_SZ, 4096) != -1;
+#else
+    return false;
+#endif
+  }
+
+  int read_[nsubs];
+  int write_[nsubs];
+};
+
+TEST_F(broadcast, EverySubscriberReceivesMessage) {
+  auto bc = msgstream_broadcast_alloc(buf_size, MSGSTREAM_BROADCAST_DROP);
+  ASSERT_TRUE(bc);
+
+  for (size_t i = 0; i < nsubs; ++i)
+    ASSERT_EQ(msgstream_broadcast_add(bc, write_[i]), MSGSTREAM_OK);
+
+  ASSERT_EQ(msgstream_broadcast_publish(bc, "hello", 5), MSGSTREAM_OK);
+  ASSERT_EQ(msgstream_broadcast_publish(bc, "world", 5), MSGSTREAM_OK);
+
+  for (size_t i = 0; i < nsubs; ++i) {
+    char buf[buf_size];
+    size_t msg_size;
+    ASSERT_EQ(msgstream_fd_recv(read_[i], buf, buf_size, &msg_size),
+              MSGSTREAM_OK);
+    EXPECT_EQ((std::string_view{buf, msg_size}), "hello");
+
+    ASSERT_EQ(msgstream_fd_recv(read_[i], buf, buf_size, &msg_size),
+              MSGSTREAM_OK);
+    EXPECT_EQ((std::string_view{buf, msg_size}), "world");
+  }
+
+  msgstream_broadcast_free(bc);
+}
+
+TEST_F(broadcast, RemovedSubscriberReceivesNothing) {
+  auto bc = msgstream_broadcast_alloc(buf_size, MSGSTREAM_BROADCAST_DROP);
+  ASSERT_TRUE(bc);
+
+  ASSERT_EQ(msgstream_broadcast_add(bc, write_[0]), MSGSTREAM_OK);
+  ASSERT_EQ(msgstream_broadcast_add(bc, write_[1]), MSGSTREAM_OK);
+  ASSERT_EQ(msgstream_broadcast_remove(bc, write_[0]), MSGSTREAM_OK);
+  ASSERT_EQ(msgstream_broadcast_publish(bc, "hello", 5), MSGSTREAM_OK);
+
+  fcntl(read_[0], F_SETFL, O_NONBLOCK);
+  char b;
+  EXPECT_EQ(read(read_[0], &b, 1), -1);
+
+  char buf[buf_size];
+  size_t msg_size;
+  ASSERT_EQ(msgstream_fd_recv(read_[1], buf, buf_size, &msg_size),
+            MSGSTREAM_OK);
+  EXPECT_EQ((std::string_view{buf, msg_size}), "hello");
+
+  msgstream_broadcast_free(bc);
+}
+
+TEST_F(broadcast, SlowSubscriberDropsWholeMessagesOnly) {
+  if (!make_slow(0))
+    GTEST_SKIP() << "Can't shrink pipe";
+
+  auto bc = msgstream_broadcast_alloc(buf_size, MSGSTREAM_BROADCAST_DROP);
+  ASSERT_TRUE(bc);
+
+  for (size_t i = 0; i < nsubs; ++i)
+    ASSERT_EQ(msgstream_broadcast_add(bc, write_[i]), MSGSTREAM_OK);
+
+  std::vector<uint8_t> msg(3000);
+  for (uint8_t i = 1; i <= 3; ++i) {
+    std::fill(msg.begin(), msg.end(), i);
+    ASSERT_EQ(msgstream_broadcast_publish(bc, msg.data(), msg.size()),
+              MSGSTREAM_OK);
+  }
+
+  // subscriber 0 took message 1, part of 2, and missed 3
+  EXPECT_EQ(msgstream_broadcast_dropped(bc), 1);
+
+  std::vector<uint8_t> buf(buf_size);
+  size_t msg_size;
+  ASSERT_EQ(msgstream_fd_recv(read_[0], buf.data(), buf_size, &msg_size),
+            MSGSTREAM_OK);
+  EXPECT_EQ(buf[0], 1);
+
+  size_t nbacklogged;
+  ASSERT_EQ(msgstream_broadcast_flush(bc, &nbacklogged), MSGSTREAM_OK);
+  EXPECT_EQ(nbacklogged, 0);
+
+  ASSERT_EQ(msgstream_fd_recv(read_[0], buf.data(), buf_size, &msg_size),
+            MSGSTREAM_OK);
+  EXPECT_EQ(msg_size, msg.size());
+  EXPECT_EQ(buf[0], 2);
+  EXPECT_EQ(buf[msg_size - 1], 2);
+
+  for (size_t i = 1; i < nsubs; ++i) {
+    for (uint8_t n = 1; n <= 3; ++n) {
+      ASSERT_EQ(msgstream_fd_recv(read_[i], buf.data(), buf_size, &msg_size),
+                MSGSTREAM_OK);
+      EXPECT_EQ(buf[msg_size - 1], n);
+    }
+  }
+
+  msgstream_broadcast_free(bc);
+}
+
+TEST_F(broadcast, SlowSubscriberIsDisconnected) {
+  if (!make_slow(0))
+    GTEST_SKIP() << "Can't shrink pipe";
+
+  auto bc =
+      msgstream_broadcast_alloc(buf_size, MSGSTREAM_BROADCAST_DISCONNECT);
+  ASSERT_TRUE(bc);
+
+  for (size_t i = 0; i < nsubs; ++i)
+    ASSERT_EQ(msgstream_broadcast_add(bc, write_[i]), MSGSTREAM_OK);
+
+  std::vector<uint8_t> msg(3000);
+  for (int i = 0; i < 3; ++i)
+    ASSERT_EQ(msgstream_broadcast_publish(bc, msg.data(), msg.size()),
+              MSGSTREAM_OK);
+
+  int fd;
+  ASSERT_TRUE(msgstream_broadcast_next_disconnected(bc, &fd));
+  EXPECT_EQ(fd, write_[0]);
+  EXPECT_FALSE(msgstream_broadcast_next_disconnected(bc, &fd));
+
+  msgstream_broadcast_free(bc);
+}
+
+TEST_F(broadcast, ClosedSubscriberIsDisconnected) {
+  auto bc = msgstream_broadcast_alloc(buf_size, MSGSTREAM_BROADCAST_DROP);
+  ASSERT_TRUE(bc);
+
+  for (size_t i = 0; i < nsubs; ++i)
+    ASSERT_EQ(msgstream_broadcast_add(bc, write_[i]), MSGSTREAM_OK);
+
+  close(read_[0]);
+  read_[0] = -1;
+
+  // SIGPIPE would kill the test if it weren't suppressed
+  ASSERT_EQ(msgstream_broadcast_publish(bc, "hello", 5), MSGSTREAM_OK);
+
+  int fd;
+  ASSERT_TRUE(msgstream_broadcast_next_disconnected(bc, &fd));
+  EXPECT_EQ(fd, write_[0]);
+  EXPECT_FALSE(msgstream_broadcast_next_disconnected(bc, &fd));
+
+  for (size_t i = 1; i < nsubs; ++i) {
+    char buf[buf_size];
+    size_t msg_size;
+    ASSERT_EQ(msgstream_fd_recv(read_[i], buf, buf_size, &msg_size),
+              MSGSTREAM_OK);
+    EXPECT_EQ((std::string_view{buf, msg_size}), "hello");
+  }
+
+  msgstream_broadcast_free(bc);
+}
+
+#ifdef __linux__
+TEST_F(broadcast, FailedDrainDoesNotCorruptNextMessage) {
+  auto bc = msgstream_broadcast_alloc(buf_size, MSGSTREAM_BROADCAST_DROP);
+  ASSERT_TRUE(bc);
+
+  for (size_t i = 0; i < nsubs; ++i)
+    ASSERT_EQ(msgstream_broadcast_add(bc, write_[i]), MSGSTREAM_OK);
+
+  // leave most of the first frame in the internal pipe
+  splice_budget = 1;
+  EXPECT_EQ(msgstream_broadcast_publish(bc, "hello", 5), MSGSTREAM_OK);
+  splice_budget = -1;
+
+  ASSERT_EQ(msgstream_broadcast_publish(bc, "world", 5), MSGSTREAM_OK);
+
+  for (size_t i = 0; i < nsubs; ++i) {
+    char buf[buf_size];
+    size_t msg_size;
+    ASSERT_EQ(msgstream_fd_recv(read_[i], buf, buf_size, &msg_size),
+              MSGSTREAM_OK);
+    EXPECT_EQ((std::string_view{buf, msg_size}), "hello");
+
+    ASSERT_EQ(msgstream_fd_recv(read_[i], buf, buf_size, &msg_size),
+              MSGSTREAM_OK);
+    EXPECT_EQ((std::string_view{buf, msg_size}), "world");
+  }
+
+  msgstream_broadcast_free(bc);
+}
+#endif
+
+TEST(BroadcastSocket, NonPipeSubscriberIsWrittenDirectly) {
+  int sv[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+
+  auto bc = msgstream_broadcast_alloc(64, MSGSTREAM_BROADCAST_DROP);
+  ASSERT_TRUE(bc);
+  ASSERT_EQ(msgstream_broadcast_add(bc, sv[0]), MSGSTREAM_OK);
+  ASSERT_EQ(msgstream_broadcast_publish(bc, "hello", 5), MSGSTREAM_OK);
+
+  char buf[64];
+  size_t msg_size;
+  ASSERT_EQ(msgstream_fd_recv(sv[1], buf, sizeof(buf), &msg_size),
+            MSGSTREAM_OK);
+  EXPECT_EQ((std::string_view{buf, msg_size}), "hello");
+
+  msgstream_broadcast_free(bc);
+  close(sv[0]);
+  close(sv[1]);
+}
+
+TEST(BroadcastSocket, ClosedSocketSubscriberIsDisconnected) {
+  int sv[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+  close(sv[1]);
+
+  auto bc = msgstream_broadcast_alloc(64, MSGSTREAM_BROADCAST_DROP);
+  ASSERT_TRUE(bc);
+  ASSERT_EQ(msgstream_broadcast_add(bc, sv[0]), MSGSTREAM_OK);
+  ASSERT_EQ(msgstream_broadcast_publish(bc, "hello", 5), MSGSTREAM_OK);
+
+  int fd;
+  ASSERT_TRUE(msgstream_broadcast_next_disconnected(bc, &fd));
+  EXPECT_EQ(fd, sv[0]);
+
+  msgstream_broadcast_free(bc);
+  close(sv[0]);
+}
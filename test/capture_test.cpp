@@ -0,0 +1,256 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#include <gtest/gtest.h>
+
+#include "msgstream/capture.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string_view>
+#include <thread>
+
+class capture : public testing::Test {
+protected:
+  void SetUp() override {
+    int fds[2];
+    if (pipe(fds) == -1) {
+      perror("pipe");
+      ADD_FAILURE() << "Failed to allocate pipe";
+    }
+
+    read_ = fds[0];
+    write_ = fds[1];
+
+    file_ = tmpfile();
+    ASSERT_TRUE(file_);
+    cap_ = fileno(file_);
+  }
+
+  void TearDown() override {
+    fclose(file_);
+    close(read_);
+    close(write_);
+  }
+
+  void rewind() { lseek(cap_, 0, SEEK_SET); }
+
+  FILE *file_;
+  int cap_;
+  int read_;
+  int write_;
+};
+
+TEST_F(capture, RecvRecordsMessageWithFd) {
+  ASSERT_EQ(msgstream_capture_write_header(cap_), MSGSTREAM_OK);
+
+  char hello[] = "hello", recv[32];
+  ASSERT_FALSE(msgstream_fd_send(write_, hello, sizeof(recv), 5));
+
+  size_t msg_size;
+  int ec =
+      msgstream_fd_capture_recv(read_, recv, sizeof(recv), &msg_size, cap_);
+  ASSERT_EQ(ec, MSGSTREAM_OK);
+  EXPECT_EQ(msg_size, 5);
+
+  rewind();
+  ASSERT_EQ(msgstream_capture_read_header(cap_), MSGSTREAM_OK);
+
+  char buf[32];
+  struct msgstream_capture_record rec;
+  ASSERT_EQ(msgstream_capture_read(cap_, buf, sizeof(buf), &rec),
+            MSGSTREAM_OK);
+  EXPECT_EQ(rec.fd, read_);
+  EXPECT_EQ(rec.msg_size, 5);
+  EXPECT_EQ((std::string_view{buf, rec.msg_size}), "hello");
+
+  EXPECT_EQ(msgstream_capture_read(cap_, buf, sizeof(buf), &rec),
+            MSGSTREAM_EOF);
+}
+
+TEST_F(capture, TimestampsIncrease) {
+  ASSERT_EQ(msgstream_capture_write_header(cap_), MSGSTREAM_OK);
+  ASSERT_EQ(msgstream_capture_write(cap_, 3, "a", 1), MSGSTREAM_OK);
+  ASSERT_EQ(msgstream_capture_write(cap_, 3, "b", 1), MSGSTREAM_OK);
+
+  rewind();
+  ASSERT_EQ(msgstream_capture_read_header(cap_), MSGSTREAM_OK);
+
+  char buf[1];
+  struct msgstream_capture_record a, b;
+  ASSERT_EQ(msgstream_capture_read(cap_, buf, sizeof(buf), &a), MSGSTREAM_OK);
+  ASSERT_EQ(msgstream_capture_read(cap_, buf, sizeof(buf), &b), MSGSTREAM_OK);
+  EXPECT_LE(a.timestamp_ns, b.timestamp_ns);
+}
+
+TEST_F(capture, ReadSkipsMessageTooBigForBuffer) {
+  ASSERT_EQ(msgstream_capture_write_header(cap_), MSGSTREAM_OK);
+  ASSERT_EQ(msgstream_capture_write(cap_, 3, "too long", 8), MSGSTREAM_OK);
+  ASSERT_EQ(msgstream_capture_write(cap_, 4, "ok", 2), MSGSTREAM_OK);
+
+  rewind();
+  ASSERT_EQ(msgstream_capture_read_header(cap_), MSGSTREAM_OK);
+
+  char buf[4];
+  struct msgstream_capture_record rec;
+  ASSERT_EQ(msgstream_capture_read(cap_, buf, sizeof(buf), &rec),
+            MSGSTREAM_BIG_MSG);
+  EXPECT_EQ(rec.fd, 3);
+  EXPECT_EQ(rec.msg_size, 8);
+
+  ASSERT_EQ(msgstream_capture_read(cap_, buf, sizeof(buf), &rec),
+            MSGSTREAM_OK);
+  EXPECT_EQ(rec.fd, 4);
+  EXPECT_EQ((std::string_view{buf, rec.msg_size}), "ok");
+}
+
+TEST_F(capture, VarintRecvRecordsMessage) {
+  ASSERT_EQ(msgstream_capture_write_header(cap_), MSGSTREAM_OK);
+  ASSERT_FALSE(msgstream_fd_varint_send(write_, "hello", 5));
+
+  char recv[32];
+  size_t msg_size;
+  ASSERT_EQ(msgstream_fd_varint_capture_recv(read_, recv, sizeof(recv),
+                                             &msg_size, cap_),
+            MSGSTREAM_OK);
+  EXPECT_EQ((std::string_view{recv, msg_size}), "hello");
+
+  rewind();
+  ASSERT_EQ(msgstream_capture_read_header(cap_), MSGSTREAM_OK);
+
+  char buf[32];
+  struct msgstream_capture_record rec;
+  ASSERT_EQ(msgstream_capture_read(cap_, buf, sizeof(buf), &rec),
+            MSGSTREAM_OK);
+  EXPECT_EQ(rec.fd, read_);
+  EXPECT_EQ((std::string_view{buf, rec.msg_size}), "hello");
+}
+
+TEST_F(capture, IncrementalRecvRecordsOnlyCompleteMessages) {
+  ASSERT_EQ(msgstream_capture_write_header(cap_), MSGSTREAM_OK);
+  fcntl(read_, F_SETFL, O_NONBLOCK);
+
+  char recv[32];
+  auto reader = msgstream_incremental_reader_alloc(recv, sizeof(recv));
+  ASSERT_TRUE(reader);
+
+  int is_complete;
+  size_t msg_size;
+  EXPECT_EQ(msgstream_fd_incremental_capture_recv(read_, reader, &is_complete,
+                                                  &msg_size, cap_),
+            MSGSTREAM_OK);
+  EXPECT_FALSE(is_complete);
+
+  ASSERT_FALSE(msgstream_fd_send(write_, "hello", sizeof(recv), 5));
+  for (int i = 0; i < 10 && !is_complete; ++i)
+    ASSERT_EQ(msgstream_fd_incremental_capture_recv(
+                  read_, reader, &is_complete, &msg_size, cap_),
+              MSGSTREAM_OK);
+
+  msgstream_incremental_reader_free(reader);
+  ASSERT_TRUE(is_complete);
+
+  rewind();
+  ASSERT_EQ(msgstream_capture_read_header(cap_), MSGSTREAM_OK);
+
+  char buf[32];
+  struct msgstream_capture_record rec;
+  ASSERT_EQ(msgstream_capture_read(cap_, buf, sizeof(buf), &rec),
+            MSGSTREAM_OK);
+  EXPECT_EQ((std::string_view{buf, rec.msg_size}), "hello");
+  EXPECT_EQ(msgstream_capture_read(cap_, buf, sizeof(buf), &rec),
+            MSGSTREAM_EOF);
+}
+
+TEST_F(capture, PooledRecvRecordsMessage) {
+  ASSERT_EQ(msgstream_capture_write_header(cap_), MSGSTREAM_OK);
+
+  auto pool = msgstream_reader_pool_alloc(32);
+  ASSERT_TRUE(pool);
+
+  struct msgstream_pooled_reader reader;
+  ASSERT_EQ(msgstream_pooled_reader_init(&reader, pool), MSGSTREAM_OK);
+
+  ASSERT_FALSE(msgstream_fd_send(write_, "hello", 32, 5));
+
+  int is_complete = 0, ec = MSGSTREAM_OK;
+  void *msg;
+  size_t msg_size;
+  for (int i = 0; i < 10 && !ec && !is_complete; ++i)
+    ec = msgstream_fd_pooled_capture_recv(read_, &reader, &is_complete, &msg,
+                                          &msg_size, cap_);
+
+  msgstream_pooled_reader_cleanup(&reader);
+  msgstream_reader_pool_free(pool);
+  ASSERT_EQ(ec, MSGSTREAM_OK);
+  ASSERT_TRUE(is_complete);
+
+  rewind();
+  ASSERT_EQ(msgstream_capture_read_header(cap_), MSGSTREAM_OK);
+
+  char buf[32];
+  struct msgstream_capture_record rec;
+  ASSERT_EQ(msgstream_capture_read(cap_, buf, sizeof(buf), &rec),
+            MSGSTREAM_OK);
+  EXPECT_EQ(rec.fd, read_);
+  EXPECT_EQ((std::string_view{buf, rec.msg_size}), "hello");
+}
+
+TEST_F(capture, NonCaptureIsRejected) {
+  ASSERT_FALSE(msgstream_fd_varint_send(cap_, "hello", 5));
+
+  rewind();
+  EXPECT_EQ(msgstream_capture_read_header(cap_), MSGSTREAM_BAD_CAPTURE);
+}
+
+TEST_F(capture, ReplayFiltersBySourceFd) {
+  ASSERT_EQ(msgstream_capture_write_header(cap_), MSGSTREAM_OK);
+  ASSERT_EQ(msgstream_capture_write(cap_, 3, "three", 5), MSGSTREAM_OK);
+  ASSERT_EQ(msgstream_capture_write(cap_, 4, "four", 4), MSGSTREAM_OK);
+  ASSERT_EQ(msgstream_capture_write(cap_, 3, "again", 5), MSGSTREAM_OK);
+
+  rewind();
+  ASSERT_EQ(msgstream_capture_replay(cap_, 3, write_, 64, 0), MSGSTREAM_OK);
+  close(write_);
+  write_ = -1;
+
+  char buf[64];
+  size_t msg_size;
+  ASSERT_EQ(msgstream_fd_recv(read_, buf, sizeof(buf), &msg_size),
+            MSGSTREAM_OK);
+  EXPECT_EQ((std::string_view{buf, msg_size}), "three");
+
+  ASSERT_EQ(msgstream_fd_recv(read_, buf, sizeof(buf), &msg_size),
+            MSGSTREAM_OK);
+  EXPECT_EQ((std::string_view{buf, msg_size}), "again");
+
+  EXPECT_EQ(msgstream_fd_recv(read_, buf, sizeof(buf), &msg_size),
+            MSGSTREAM_EOF);
+}
+
+TEST_F(capture, ReplayKeepsScaledPacing) {
+  using namespace std::chrono;
+
+  ASSERT_EQ(msgstream_capture_write_header(cap_), MSGSTREAM_OK);
+  ASSERT_EQ(msgstream_capture_write(cap_, 3, "a", 1), MSGSTREAM_OK);
+  std::this_thread::sleep_for(milliseconds{50});
+  ASSERT_EQ(msgstream_capture_write(cap_, 3, "b", 1), MSGSTREAM_OK);
+
+  // at half speed the gap doubles. only a lower bound is reliable on a busy
+  // machine, and unscaled pacing wouldn't reach it
+  rewind();
+  auto start = steady_clock::now();
+  ASSERT_EQ(msgstream_capture_replay(cap_, -1, write_, 64, 0.5),
+            MSGSTREAM_OK);
+  auto elapsed = steady_clock::now() - start;
+
+  EXPECT_GE(elapsed, milliseconds{100});
+}
@@ -0,0 +1,318 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#include <gtest/gtest.h>
+
+#include "msgstream/log.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+class log_writer : public testing::Test {
+protected:
+  void SetUp() override {
+    log_file_ = tmpfile();
+    index_file_ = tmpfile();
+    ASSERT_TRUE(log_file_);
+    ASSERT_TRUE(index_file_);
+    log_fd_ = fileno(log_file_);
+    index_fd_ = fileno(index_file_);
+    open();
+  }
+
+  void TearDown() override {
+    msgstream_log_close(log_);
+    fclose(log_file_);
+    fclose(index_file_);
+  }
+
+  void open() {
+    log_ = nullptr;
+    ASSERT_EQ(msgstream_log_open(log_fd_, index_fd_, buf_size_, &log_),
+              MSGSTREAM_OK);
+  }
+
+  void reopen() {
+    msgstream_log_close(log_);
+    open();
+  }
+
+  uint64_t append(const std::string &msg) {
+    uint64_t ordinal = UINT64_MAX;
+    EXPECT_EQ(msgstream_log_append(log_, msg.data(), msg.size(), &ordinal),
+              MSGSTREAM_OK);
+    return ordinal;
+  }
+
+  std::string read(uint64_t ordinal) {
+    char buf[buf_size_];
+    size_t msg_size = 0;
+    EXPECT_EQ(msgstream_log_read(log_, ordinal, buf, sizeof(buf), &msg_size),
+              MSGSTREAM_OK);
+    return std::string{buf, msg_size};
+  }
+
+  static off_t file_size(int fd) {
+    struct stat st;
+    EXPECT_EQ(fstat(fd, &st), 0);
+    return st.st_size;
+  }
+
+  static constexpr size_t buf_size_ = 64;
+  FILE *log_file_;
+  FILE *index_file_;
+  int log_fd_;
+  int index_fd_;
+  msgstream_log log_;
+};
+
+TEST_F(log_writer, AppendedMessagesAreReadByOrdinal) {
+  EXPECT_EQ(append("hello"), 0);
+  EXPECT_EQ(append(""), 1);
+  EXPECT_EQ(append("world"), 2);
+
+  EXPECT_EQ(msgstream_log_count(log_), 3);
+  EXPECT_EQ(read(0), "hello");
+  EXPECT_EQ(read(1), "");
+  EXPECT_EQ(read(2), "world");
+}
+
+TEST_F(log_writer, LogFileIsMsgstreamFramed) {
+  append("hello");
+  append("world");
+
+  char buf[buf_size_];
+  size_t msg_size;
+  lseek(log_fd_, 0, SEEK_SET);
+  ASSERT_EQ(msgstream_fd_recv(log_fd_, buf, sizeof(buf), &msg_size),
+            MSGSTREAM_OK);
+  EXPECT_EQ(std::string(buf, msg_size), "hello");
+  ASSERT_EQ(msgstream_fd_recv(log_fd_, buf, sizeof(buf), &msg_size),
+            MSGSTREAM_OK);
+  EXPECT_EQ(std::string(buf, msg_size), "world");
+}
+
+TEST_F(log_writer, OffsetsComeFromIndex) {
+  append("hello");
+  append("hi");
+
+  size_t hdr_size;
+  ASSERT_EQ(msgstream_header_size(buf_size_, &hdr_size), MSGSTREAM_OK);
+
+  uint64_t offset;
+  ASSERT_EQ(msgstream_log_offset(log_, 0, &offset), MSGSTREAM_OK);
+  EXPECT_EQ(offset, 0);
+  ASSERT_EQ(msgstream_log_offset(log_, 1, &offset), MSGSTREAM_OK);
+  EXPECT_EQ(offset, hdr_size + 5);
+  EXPECT_EQ(file_size(index_fd_), 16);
+}
+
+TEST_F(log_writer, ReadPastEndIsEof) {
+  append("hello");
+
+  char buf[buf_size_];
+  size_t msg_size;
+  EXPECT_EQ(msgstream_log_read(log_, 1, buf, sizeof(buf), &msg_size),
+            MSGSTREAM_EOF);
+
+  uint64_t offset;
+  EXPECT_EQ(msgstream_log_offset(log_, 1, &offset), MSGSTREAM_EOF);
+}
+
+TEST_F(log_writer, MessageBiggerThanBufferIsRejected) {
+  char big[buf_size_ + 1] = {};
+  uint64_t ordinal;
+  EXPECT_EQ(msgstream_log_append(log_, big, sizeof(big), &ordinal),
+            MSGSTREAM_BIG_MSG);
+  EXPECT_EQ(msgstream_log_count(log_), 0);
+}
+
+TEST_F(log_writer, EmptyMessageMayHaveNullBuffer) {
+  uint64_t ordinal;
+  ASSERT_EQ(msgstream_log_append(log_, nullptr, 0, &ordinal), MSGSTREAM_OK);
+  EXPECT_EQ(ordinal, 0);
+  EXPECT_EQ(read(0), "");
+
+  EXPECT_EQ(msgstream_log_append(log_, nullptr, 1, &ordinal),
+            MSGSTREAM_NULL_ARG);
+  EXPECT_EQ(msgstream_log_count(log_), 1);
+}
+
+TEST_F(log_writer, ConcurrentAppendsGetDistinctOrdinals) {
+  constexpr int nthreads = 8, per_thread = 200;
+  std::vector<std::vector<uint64_t>> ordinals(nthreads);
+  std::vector<std::thread> threads;
+
+  for (int t = 0; t < nthreads; ++t) {
+    threads.emplace_back([this, t, &ordinals] {
+      for (int i = 0; i < per_thread; ++i) {
+        std::string msg = std::to_string(t) + ":" + std::to_string(i);
+        ordinals[t].push_back(append(msg));
+      }
+    });
+  }
+
+  for (auto &th : threads)
+    th.join();
+
+  ASSERT_EQ(msgstream_log_count(log_), nthreads * per_thread);
+
+  std::vector<bool> seen(nthreads * per_thread);
+  for (int t = 0; t < nthreads; ++t) {
+    for (int i = 0; i < per_thread; ++i) {
+      uint64_t ord = ordinals[t][i];
+      ASSERT_LT(ord, seen.size());
+      EXPECT_FALSE(seen[ord]);
+      seen[ord] = true;
+      EXPECT_EQ(read(ord), std::to_string(t) + ":" + std::to_string(i));
+
+      // each thread's messages land in the order it appended them
+      if (i > 0) {
+        EXPECT_GT(ord, ordinals[t][i - 1]);
+      }
+    }
+  }
+}
+
+TEST_F(log_writer, CommitWindowStillCommitsEveryAppend) {
+  msgstream_log_set_commit_window(log_, 1000000);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t)
+    threads.emplace_back([this] { append("hello"); });
+
+  for (auto &th : threads)
+    th.join();
+
+  EXPECT_EQ(msgstream_log_count(log_), 4);
+}
+
+TEST_F(log_writer, ReopenContinuesOrdinals) {
+  append("hello");
+  append("world");
+  reopen();
+
+  EXPECT_EQ(msgstream_log_count(log_), 2);
+  EXPECT_EQ(read(1), "world");
+  EXPECT_EQ(append("again"), 2);
+  EXPECT_EQ(read(2), "again");
+}
+
+TEST_F(log_writer, ReopenIndexesFramesMissingFromIndex) {
+  append("hello");
+  append("world");
+  append("again");
+
+  // the index isn't synced, so it may lose entries the log kept
+  ASSERT_EQ(ftruncate(index_fd_, 8), 0);
+  reopen();
+
+  EXPECT_EQ(msgstream_log_count(log_), 3);
+  EXPECT_EQ(read(2), "again");
+  EXPECT_EQ(file_size(index_fd_), 24);
+}
+
+TEST_F(log_writer, ReopenDropsIndexEntriesPastLog) {
+  append("hello");
+  off_t end = file_size(log_fd_);
+  append("world");
+
+  // index entry written but log data never made it to disk
+  ASSERT_EQ(ftruncate(log_fd_, end), 0);
+  reopen();
+
+  EXPECT_EQ(msgstream_log_count(log_), 1);
+  EXPECT_EQ(file_size(index_fd_), 8);
+  EXPECT_EQ(append("again"), 1);
+  EXPECT_EQ(read(1), "again");
+}
+
+TEST_F(log_writer, ReopenTruncatesTornWrite) {
+  append("hello");
+  off_t end = file_size(log_fd_);
+
+  // a header promising more bytes than were written
+  ASSERT_EQ(msgstream_fd_send(log_fd_, "world", buf_size_, 5), MSGSTREAM_OK);
+  ASSERT_EQ(ftruncate(log_fd_, file_size(log_fd_) - 2), 0);
+  reopen();
+
+  EXPECT_EQ(msgstream_log_count(log_), 1);
+  EXPECT_EQ(file_size(log_fd_), end);
+  EXPECT_EQ(append("again"), 1);
+  EXPECT_EQ(read(1), "again");
+}
+
+TEST_F(log_writer, ReopenWithBiggerHeaderFailsWithoutTruncating) {
+  for (int i = 0; i < 10; ++i)
+    append("hello");
+
+  off_t log_size = file_size(log_fd_);
+  off_t index_size = file_size(index_fd_);
+  msgstream_log_close(log_);
+  log_ = nullptr;
+
+  // a bigger buffer needs a bigger fixed header than the log was framed with
+  EXPECT_EQ(msgstream_log_open(log_fd_, index_fd_, 1 << 20, &log_),
+            MSGSTREAM_HDR_SYNC);
+  EXPECT_EQ(file_size(log_fd_), log_size);
+  EXPECT_EQ(file_size(index_fd_), index_size);
+
+  open();
+  EXPECT_EQ(msgstream_log_count(log_), 10);
+}
+
+TEST_F(log_writer, ReopenWithSmallerBufferFailsWithoutTruncating) {
+  append("hello");
+  append(std::string(40, 'x'));
+
+  off_t log_size = file_size(log_fd_);
+  msgstream_log_close(log_);
+  log_ = nullptr;
+
+  EXPECT_EQ(msgstream_log_open(log_fd_, index_fd_, 16, &log_),
+            MSGSTREAM_BIG_MSG);
+  EXPECT_EQ(file_size(log_fd_), log_size);
+
+  open();
+  EXPECT_EQ(msgstream_log_count(log_), 2);
+}
+
+TEST_F(log_writer, ReopenDropsZeroFilledIndexTail) {
+  for (int i = 0; i < 10; ++i)
+    append(std::to_string(i));
+
+  // a crash can leave the unsynced index with a zero-filled tail
+  uint8_t zeros[16] = {};
+  ASSERT_EQ(pwrite(index_fd_, zeros, sizeof(zeros), file_size(index_fd_)),
+            sizeof(zeros));
+  reopen();
+
+  ASSERT_EQ(msgstream_log_count(log_), 10);
+  EXPECT_EQ(file_size(index_fd_), 80);
+  for (int i = 0; i < 10; ++i)
+    EXPECT_EQ(read(i), std::to_string(i));
+}
+
+TEST_F(log_writer, ReopenDropsIndexEntryNotFollowingPrevious) {
+  append("hello");
+  append("world");
+  append("again");
+
+  // last entry points at a real frame, but not the one after entry 1
+  uint8_t entry[8] = {};
+  ASSERT_EQ(pwrite(index_fd_, entry, sizeof(entry), 16), sizeof(entry));
+  reopen();
+
+  EXPECT_EQ(msgstream_log_count(log_), 3);
+  EXPECT_EQ(read(2), "again");
+}
@@ -10,13 +10,18 @@
 #include "msgstream.h"
 
 #include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
 #include <string_view>
 #include <thread>
+#include <vector>
 
 using std::size_t;
 using std::uint8_t;
@@ -138,6 +143,112 @@ TEST_F(f, TransferHugeMessage) {
   }
 }
 
+static void ignore_signal(int) {}
+
+TEST_F(f, SendResumesAfterPartialWrites) {
+  // a signal during a blocking write to a full pipe makes write() return the
+  // bytes it had written so far. SA_RESTART only restarts writes that hadn't
+  // written anything yet.
+  struct sigaction sa = {}, old_sa;
+  sa.sa_handler = ignore_signal;
+  sa.sa_flags = SA_RESTART;
+  ASSERT_EQ(sigaction(SIGUSR1, &sa, &old_sa), 0);
+
+  size_t hdr_size;
+  constexpr size_t msgsz = 1 << 20;
+  ASSERT_EQ(msgstream_header_size(msgsz, &hdr_size), MSGSTREAM_OK);
+
+  std::vector<uint8_t> msg(msgsz);
+  for (size_t i = 0; i < msgsz; ++i)
+    msg[i] = (7 * i) % 256;
+
+  int sret = MSGSTREAM_EOF;
+  std::thread th{
+      [&] { sret = msgstream_fd_send(write_, msg.data(), msgsz, msgsz); }};
+
+  // interrupt the sender each time the pipe is drained a little
+  std::vector<uint8_t> wire(hdr_size + msgsz);
+  size_t nread = 0;
+  while (nread < wire.size()) {
+    pthread_kill(th.native_handle(), SIGUSR1);
+    ssize_t n = read(read_, wire.data() + nread,
+                     std::min<size_t>(4096, wire.size() - nread));
+    if (n <= 0)
+      break;
+
+    nread += n;
+  }
+
+  th.join();
+  sigaction(SIGUSR1, &old_sa, nullptr);
+
+  EXPECT_EQ(sret, MSGSTREAM_OK);
+  ASSERT_EQ(nread, wire.size());
+
+  size_t size;
+  ASSERT_EQ(msgstream_decode_header(wire.data(), hdr_size, &size),
+            MSGSTREAM_OK);
+  EXPECT_EQ(size, msgsz);
+  EXPECT_TRUE(std::equal(msg.begin(), msg.end(), wire.begin() + hdr_size));
+}
+
+// interrupt a thread blocked in a call that only a signal will end
+static void interrupt_until_done(std::thread &th, std::atomic<bool> &done) {
+  while (!done) {
+    pthread_kill(th.native_handle(), SIGUSR1);
+    std::this_thread::yield();
+  }
+}
+
+TEST_F(f, SignalDuringRecvIsReadError) {
+  // without SA_RESTART, a blocked read() fails with EINTR
+  struct sigaction sa = {}, old_sa;
+  sa.sa_handler = ignore_signal;
+  ASSERT_EQ(sigaction(SIGUSR1, &sa, &old_sa), 0);
+
+  std::atomic<bool> done = false;
+  int ret = MSGSTREAM_OK;
+  std::thread th{[&] {
+    char buf[64];
+    size_t msg_size;
+    ret = msgstream_fd_recv(read_, buf, sizeof(buf), &msg_size);
+    done = true;
+  }};
+
+  interrupt_until_done(th, done);
+  th.join();
+  sigaction(SIGUSR1, &old_sa, nullptr);
+
+  EXPECT_EQ(ret, MSGSTREAM_SYS_READ_ERR);
+}
+
+TEST_F(f, SignalDuringSendIsWriteError) {
+  struct sigaction sa = {}, old_sa;
+  sa.sa_handler = ignore_signal;
+  ASSERT_EQ(sigaction(SIGUSR1, &sa, &old_sa), 0);
+
+  // fill the pipe so the next write blocks before writing anything
+  int flags = fcntl(write_, F_GETFL);
+  ASSERT_EQ(fcntl(write_, F_SETFL, flags | O_NONBLOCK), 0);
+  char junk[4096] = {};
+  while (write(write_, junk, sizeof(junk)) > 0)
+    ;
+  ASSERT_EQ(fcntl(write_, F_SETFL, flags), 0);
+
+  std::atomic<bool> done = false;
+  int ret = MSGSTREAM_OK;
+  std::thread th{[&] {
+    ret = msgstream_fd_send(write_, "hello", 64, 5);
+    done = true;
+  }};
+
+  interrupt_until_done(th, done);
+  th.join();
+  sigaction(SIGUSR1, &old_sa, nullptr);
+
+  EXPECT_EQ(ret, MSGSTREAM_SYS_WRITE_ERR);
+}
+
 #define EXPAND(X) X
 
 #define DO_TEST(BUF_SZ, RET)                                                   \
@@ -383,3 +494,255 @@ TEST_F(f, NoDataOnNonBlockingFdIsNotError) {
   EXPECT_EQ(ec, MSGSTREAM_OK);
   EXPECT_FALSE(is_complete);
 }
+
+TEST(VarintHeader, SizeGrowsSevenBitsPerByte) {
+  EXPECT_EQ(msgstream_varint_header_size(0), 1);
+  EXPECT_EQ(msgstream_varint_header_size(0x7f), 1);
+  EXPECT_EQ(msgstream_varint_header_size(0x80), 2);
+  EXPECT_EQ(msgstream_varint_header_size(0x3fff), 2);
+  EXPECT_EQ(msgstream_varint_header_size(0x4000), 3);
+  EXPECT_EQ(msgstream_varint_header_size(SIZE_MAX),
+            sizeof(size_t) == 8 ? 10 : 5);
+}
+
+TEST(VarintHeader, EncodesLeb128) {
+  char header_buf[MSGSTREAM_VARINT_HEADER_BUF_SIZE];
+  size_t hdr_size = 0;
+  auto ec = msgstream_varint_encode_header(300, header_buf, sizeof(header_buf),
+                                           &hdr_size);
+  EXPECT_FALSE(ec);
+
+  std::string_view header{header_buf, header_buf + hdr_size};
+  EXPECT_EQ(header, "\xac\x02");
+}
+
+TEST(VarintHeader, EncodeIntoSmallBufferIsError) {
+  uint8_t header_buf[1];
+  size_t hdr_size = 0;
+  auto ec = msgstream_varint_encode_header(300, header_buf, sizeof(header_buf),
+                                           &hdr_size);
+  EXPECT_EQ(ec, MSGSTREAM_SMALL_BUF);
+}
+
+TEST(VarintHeader, DecodeReportsHeaderAndMessageSize) {
+  uint8_t header_buf[] = {0xac, 0x02, 0xff};
+  size_t hdr_size = 0, msg_size = 0;
+  auto ec = msgstream_varint_decode_header(header_buf, sizeof(header_buf),
+                                           &hdr_size, &msg_size);
+  EXPECT_FALSE(ec);
+  EXPECT_EQ(hdr_size, 2);
+  EXPECT_EQ(msg_size, 300);
+}
+
+TEST(VarintHeader, DecodeUnfinishedHeaderIsSmallHdr) {
+  uint8_t header_buf[] = {0xac};
+  size_t hdr_size, msg_size;
+  auto ec = msgstream_varint_decode_header(header_buf, sizeof(header_buf),
+                                           &hdr_size, &msg_size);
+  EXPECT_EQ(ec, MSGSTREAM_SMALL_HDR);
+}
+
+TEST(VarintHeader, DecodeOverlongHeaderIsError) {
+  uint8_t header_buf[MSGSTREAM_VARINT_HEADER_BUF_SIZE + 1];
+  memset(header_buf, 0x80, sizeof(header_buf));
+  size_t hdr_size, msg_size;
+  auto ec = msgstream_varint_decode_header(header_buf, sizeof(header_buf),
+                                           &hdr_size, &msg_size);
+  EXPECT_EQ(ec, MSGSTREAM_BIG_HDR);
+}
+
+TEST(VarintHeader, DecodeNonMinimalHeaderIsSyncError) {
+  // 5 with a redundant zero group
+  const uint8_t header_buf[] = {0x85, 0x00};
+  size_t hdr_size, msg_size;
+  auto ec = msgstream_varint_decode_header(header_buf, sizeof(header_buf),
+                                           &hdr_size, &msg_size);
+  EXPECT_EQ(ec, MSGSTREAM_HDR_SYNC);
+}
+
+TEST(VarintHeader, RoundTripsMaxSize) {
+  uint8_t header_buf[MSGSTREAM_VARINT_HEADER_BUF_SIZE];
+  size_t hdr_size, dec_hdr_size, msg_size;
+  auto ec = msgstream_varint_encode_header(SIZE_MAX, header_buf,
+                                           sizeof(header_buf), &hdr_size);
+  ASSERT_FALSE(ec);
+
+  ec = msgstream_varint_decode_header(header_buf, hdr_size, &dec_hdr_size,
+                                      &msg_size);
+  EXPECT_FALSE(ec);
+  EXPECT_EQ(dec_hdr_size, hdr_size);
+  EXPECT_EQ(msg_size, SIZE_MAX);
+}
+
+TEST_F(f, VarintTransferStringHello) {
+  char hello[] = "hello", recv[64] = {};
+  size_t len = strlen(hello);
+
+  auto ec = msgstream_fd_varint_send(write_, hello, len);
+  EXPECT_FALSE(ec);
+
+  size_t size = 0;
+  ec = msgstream_fd_varint_recv(read_, recv, sizeof(recv), &size);
+  EXPECT_FALSE(ec);
+  EXPECT_EQ(size, len);
+
+  std::string_view recv_sv{recv, recv + size};
+  EXPECT_EQ(recv_sv, "hello");
+}
+
+TEST_F(f, VarintSmallMessageHasOneByteHeader) {
+  char hello[] = "hello", wire[16] = {};
+  auto ec = msgstream_fd_varint_send(write_, hello, 5);
+  ASSERT_FALSE(ec);
+
+  EXPECT_EQ(read(read_, wire, sizeof(wire)), 6);
+  EXPECT_EQ(wire[0], 5);
+}
+
+TEST_F(f, VarintRecvTooBigForBufferIsError) {
+  char hello[] = "hello", recv[4];
+  auto ec = msgstream_fd_varint_send(write_, hello, 5);
+  ASSERT_FALSE(ec);
+
+  size_t size = 1;
+  ec = msgstream_fd_varint_recv(read_, recv, sizeof(recv), &size);
+  EXPECT_EQ(ec, MSGSTREAM_BIG_MSG);
+  EXPECT_EQ(size, 0);
+}
+
+TEST_F(f, VarintTransferHugeMessage) {
+  std::vector<uint8_t> huge(HUGE), recv(HUGE);
+  for (size_t i = 0; i < HUGE; ++i)
+    huge[i] = i % 256;
+
+  int sret = MSGSTREAM_EOF;
+  std::thread th{
+      [&] { sret = msgstream_fd_varint_send(write_, huge.data(), HUGE); }};
+
+  size_t size;
+  auto rret = msgstream_fd_varint_recv(read_, recv.data(), HUGE, &size);
+  th.join();
+
+  EXPECT_EQ(rret, MSGSTREAM_OK);
+  EXPECT_EQ(sret, MSGSTREAM_OK);
+  EXPECT_EQ(size, HUGE);
+  EXPECT_EQ(recv, huge);
+}
+
+// a multi-byte header is read along with the start of the payload
+TEST_F(f, VarintRecvKeepsPayloadReadWithHeader) {
+  std::vector<uint8_t> big(300);
+  for (size_t i = 0; i < big.size(); ++i)
+    big[i] = i % 251;
+
+  ASSERT_FALSE(msgstream_fd_varint_send(write_, big.data(), big.size()));
+  ASSERT_FALSE(msgstream_fd_varint_send(write_, "hi", 2));
+
+  std::vector<uint8_t> recv(512);
+  size_t size;
+  ASSERT_EQ(msgstream_fd_varint_recv(read_, recv.data(), recv.size(), &size),
+            MSGSTREAM_OK);
+  recv.resize(size);
+  EXPECT_EQ(recv, big);
+
+  char buf[8];
+  ASSERT_EQ(msgstream_fd_varint_recv(read_, buf, sizeof(buf), &size),
+            MSGSTREAM_OK);
+  EXPECT_EQ((std::string_view{buf, size}), "hi");
+}
+
+TEST_F(f, VarintIncrementalKeepsPayloadReadWithHeader) {
+  std::vector<uint8_t> big(300);
+  for (size_t i = 0; i < big.size(); ++i)
+    big[i] = i % 251;
+
+  ASSERT_FALSE(msgstream_fd_varint_send(write_, big.data(), big.size()));
+  ASSERT_FALSE(msgstream_fd_varint_send(write_, "hi", 2));
+  ASSERT_FALSE(fcntl(read_, F_SETFL, O_NONBLOCK) == -1);
+
+  std::vector<uint8_t> recv(512);
+  auto reader =
+      msgstream_varint_incremental_reader_alloc(recv.data(), recv.size());
+  ASSERT_TRUE(reader);
+
+  std::vector<std::vector<uint8_t>> msgs;
+  int ec = MSGSTREAM_OK;
+  for (int i = 0; !ec && msgs.size() < 2 && i < 100; ++i) {
+    int is_complete;
+    size_t size;
+    ec = msgstream_fd_incremental_recv(read_, reader, &is_complete, &size);
+    if (is_complete)
+      msgs.emplace_back(recv.begin(), recv.begin() + size);
+  }
+
+  msgstream_incremental_reader_free(reader);
+
+  ASSERT_EQ(ec, MSGSTREAM_OK);
+  ASSERT_EQ(msgs.size(), 2);
+  EXPECT_EQ(msgs[0], big);
+  EXPECT_EQ(msgs[1], (std::vector<uint8_t>{'h', 'i'}));
+}
+
+TEST_F(f, VarintDecodesOneByteAtATime) {
+  std::array<uint8_t, 512> recv, send;
+  size_t msgsz = 300;
+
+  for (size_t i = 0; i < msgsz; ++i)
+    send[i] = (3 * i) % 0x100;
+
+  uint8_t hdr_buf[MSGSTREAM_VARINT_HEADER_BUF_SIZE];
+  size_t hdr_size;
+  int ec = msgstream_varint_encode_header(msgsz, hdr_buf, sizeof(hdr_buf),
+                                          &hdr_size);
+  ASSERT_EQ(ec, MSGSTREAM_OK);
+
+  auto reader =
+      msgstream_varint_incremental_reader_alloc(recv.data(), recv.size());
+  ASSERT_TRUE(reader);
+
+  ASSERT_FALSE(fcntl(read_, F_SETFL, O_NONBLOCK) == -1);
+
+  int is_complete;
+  size_t recv_msg_size;
+
+  for (size_t i = 0; i < hdr_size; ++i) {
+    write(write_, &hdr_buf[i], 1);
+
+    ec = msgstream_fd_incremental_recv(read_, reader, &is_complete,
+                                       &recv_msg_size);
+    ASSERT_EQ(ec, MSGSTREAM_OK);
+    ASSERT_FALSE(is_complete);
+  }
+
+  for (size_t i = 0; i < msgsz; ++i) {
+    write(write_, &send[i], 1);
+
+    ec = msgstream_fd_incremental_recv(read_, reader, &is_complete,
+                                       &recv_msg_size);
+    ASSERT_EQ(ec, MSGSTREAM_OK);
+    ASSERT_EQ(is_complete, i == msgsz - 1);
+  }
+
+  EXPECT_EQ(recv_msg_size, msgsz);
+  for (size_t i = 0; i < msgsz; ++i)
+    EXPECT_EQ(recv[i], ((3 * i) % 0x100));
+
+  msgstream_incremental_reader_free(reader);
+}
+
+TEST_F(f, VarintIncrementalReadsEmptyMessage) {
+  std::array<char, 8> buf;
+  auto reader = msgstream_varint_incremental_reader_alloc(buf.data(), 8);
+  ASSERT_TRUE(reader);
+
+  ASSERT_FALSE(msgstream_fd_varint_send(write_, buf.data(), 0));
+
+  int is_complete;
+  size_t msgsz = 1;
+  int ec = msgstream_fd_incremental_recv(read_, reader, &is_complete, &msgsz);
+  EXPECT_EQ(ec, MSGSTREAM_OK);
+  EXPECT_TRUE(is_complete);
+  EXPECT_EQ(msgsz, 0);
+
+  msgstream_incremental_reader_free(reader);
+}
@@ -0,0 +1,417 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#include <gtest/gtest.h>
+
+#include "msgstream/mux.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string_view>
+#include <thread>
+#include <vector>
+
+class mux : public testing::Test {
+protected:
+  void SetUp() override {
+    int fds[2];
+    if (pipe(fds) == -1) {
+      perror("pipe");
+      ADD_FAILURE() << "Failed to allocate pipe";
+    }
+
+    read_ = fds[0];
+    write_ = fds[1];
+
+    mux_ = msgstream_mux_alloc(write_, 2, 16);
+    ASSERT_TRUE(mux_);
+
+    demux_ = msgstream_demux_alloc(2, 4096);
+    ASSERT_TRUE(demux_);
+  }
+
+  void TearDown() override {
+    msgstream_mux_free(mux_);
+    msgstream_demux_free(demux_);
+    close(read_);
+    close(write_);
+  }
+
+  msgstream_mux mux_;
+  msgstream_demux demux_;
+  int read_;
+  int write_;
+};
+
+TEST_F(mux, SendsSmallMessageOnChannel) {
+  ASSERT_EQ(msgstream_mux_send(mux_, 1, "hello", 5), MSGSTREAM_OK);
+  EXPECT_EQ(msgstream_mux_queued(mux_, 1), 1);
+
+  ASSERT_EQ(msgstream_mux_flush(mux_), MSGSTREAM_OK);
+  EXPECT_EQ(msgstream_mux_queued(mux_, 1), 0);
+
+  unsigned channel;
+  const void *msg;
+  size_t msg_size;
+  ASSERT_EQ(msgstream_demux_recv(read_, demux_, &channel, &msg, &msg_size),
+            MSGSTREAM_OK);
+  EXPECT_EQ(channel, 1);
+  EXPECT_EQ((std::string_view{(const char *)msg, msg_size}), "hello");
+}
+
+TEST_F(mux, ReassemblesMessageSplitIntoChunks) {
+  std::vector<uint8_t> big(1000);
+  for (size_t i = 0; i < big.size(); ++i)
+    big[i] = i % 251;
+
+  ASSERT_EQ(msgstream_mux_send(mux_, 0, big.data(), big.size()),
+            MSGSTREAM_OK);
+  ASSERT_EQ(msgstream_mux_flush(mux_), MSGSTREAM_OK);
+
+  unsigned channel;
+  const void *msg;
+  size_t msg_size;
+  ASSERT_EQ(msgstream_demux_recv(read_, demux_, &channel, &msg, &msg_size),
+            MSGSTREAM_OK);
+  EXPECT_EQ(channel, 0);
+
+  const uint8_t *bytes = (const uint8_t *)msg;
+  EXPECT_EQ(std::vector<uint8_t>(bytes, bytes + msg_size), big);
+}
+
+TEST_F(mux, SendsEmptyMessage) {
+  ASSERT_EQ(msgstream_mux_send(mux_, 0, nullptr, 0), MSGSTREAM_OK);
+  ASSERT_EQ(msgstream_mux_flush(mux_), MSGSTREAM_OK);
+
+  unsigned channel = 1;
+  const void *msg;
+  size_t msg_size = 1;
+  ASSERT_EQ(msgstream_demux_recv(read_, demux_, &channel, &msg, &msg_size),
+            MSGSTREAM_OK);
+  EXPECT_EQ(channel, 0);
+  EXPECT_EQ(msg_size, 0);
+}
+
+TEST_F(mux, HighPriorityMessageOvertakesBulkTransfer) {
+  std::vector<uint8_t> bulk(1000, 'b');
+  ASSERT_EQ(msgstream_mux_set_priority(mux_, 0, 1), MSGSTREAM_OK);
+
+  ASSERT_EQ(msgstream_mux_send(mux_, 1, bulk.data(), bulk.size()),
+            MSGSTREAM_OK);
+
+  int is_idle, would_block;
+  for (int i = 0; i < 3; ++i)
+    ASSERT_EQ(msgstream_mux_write_chunk(mux_, &is_idle, &would_block),
+              MSGSTREAM_OK);
+
+  ASSERT_EQ(msgstream_mux_send(mux_, 0, "urgent", 6), MSGSTREAM_OK);
+  ASSERT_EQ(msgstream_mux_flush(mux_), MSGSTREAM_OK);
+
+  unsigned channel;
+  const void *msg;
+  size_t msg_size;
+  ASSERT_EQ(msgstream_demux_recv(read_, demux_, &channel, &msg, &msg_size),
+            MSGSTREAM_OK);
+  EXPECT_EQ(channel, 0);
+  EXPECT_EQ((std::string_view{(const char *)msg, msg_size}), "urgent");
+
+  ASSERT_EQ(msgstream_demux_recv(read_, demux_, &channel, &msg, &msg_size),
+            MSGSTREAM_OK);
+  EXPECT_EQ(channel, 1);
+  EXPECT_EQ(msg_size, bulk.size());
+}
+
+TEST_F(mux, EqualPrioritiesTakeTurns) {
+  std::vector<uint8_t> three_chunks(40, 'a');
+  ASSERT_EQ(msgstream_mux_send(mux_, 0, three_chunks.data(), 40),
+            MSGSTREAM_OK);
+  ASSERT_EQ(msgstream_mux_send(mux_, 1, "b", 1), MSGSTREAM_OK);
+  ASSERT_EQ(msgstream_mux_flush(mux_), MSGSTREAM_OK);
+
+  unsigned channel;
+  const void *msg;
+  size_t msg_size;
+  ASSERT_EQ(msgstream_demux_recv(read_, demux_, &channel, &msg, &msg_size),
+            MSGSTREAM_OK);
+  EXPECT_EQ(channel, 1);
+
+  ASSERT_EQ(msgstream_demux_recv(read_, demux_, &channel, &msg, &msg_size),
+            MSGSTREAM_OK);
+  EXPECT_EQ(channel, 0);
+  EXPECT_EQ(msg_size, 40);
+}
+
+TEST_F(mux, OutOfRangeChannelIsError) {
+  EXPECT_EQ(msgstream_mux_send(mux_, 2, "x", 1), MSGSTREAM_BAD_CHANNEL);
+  EXPECT_EQ(msgstream_mux_set_priority(mux_, 2, 1), MSGSTREAM_BAD_CHANNEL);
+
+  auto wide = msgstream_mux_alloc(write_, 3, 16);
+  ASSERT_TRUE(wide);
+  ASSERT_EQ(msgstream_mux_send(wide, 2, "x", 1), MSGSTREAM_OK);
+  ASSERT_EQ(msgstream_mux_flush(wide), MSGSTREAM_OK);
+  msgstream_mux_free(wide);
+
+  unsigned channel;
+  const void *msg;
+  size_t msg_size;
+  EXPECT_EQ(msgstream_demux_recv(read_, demux_, &channel, &msg, &msg_size),
+            MSGSTREAM_BAD_CHANNEL);
+}
+
+TEST_F(mux, MessageBiggerThanDemuxLimitIsError) {
+  std::vector<uint8_t> huge(5000);
+  ASSERT_EQ(msgstream_mux_send(mux_, 0, huge.data(), huge.size()),
+            MSGSTREAM_OK);
+  ASSERT_EQ(msgstream_mux_flush(mux_), MSGSTREAM_OK);
+
+  unsigned channel;
+  const void *msg;
+  size_t msg_size;
+  EXPECT_EQ(msgstream_demux_recv(read_, demux_, &channel, &msg, &msg_size),
+            MSGSTREAM_BIG_MSG);
+}
+
+TEST_F(mux, ChunkWithoutFlagsIsSyncError) {
+  // a one byte frame holding only channel 0
+  const uint8_t chunk[] = {0x01, 0x00};
+  ASSERT_EQ(write(write_, chunk, sizeof(chunk)), (ssize_t)sizeof(chunk));
+
+  unsigned channel;
+  const void *msg;
+  size_t msg_size;
+  EXPECT_EQ(msgstream_demux_recv(read_, demux_, &channel, &msg, &msg_size),
+            MSGSTREAM_HDR_SYNC);
+}
+
+TEST_F(mux, EmptyChunkIsSyncError) {
+  const uint8_t chunk[] = {0x00, 0x00, 0x01};
+  ASSERT_EQ(write(write_, chunk, sizeof(chunk)), (ssize_t)sizeof(chunk));
+
+  unsigned channel;
+  const void *msg;
+  size_t msg_size;
+  EXPECT_EQ(msgstream_demux_recv(read_, demux_, &channel, &msg, &msg_size),
+            MSGSTREAM_HDR_SYNC);
+}
+
+TEST_F(mux, IncrementalRecvDoesNotBlock) {
+  ASSERT_FALSE(fcntl(read_, F_SETFL, O_NONBLOCK) == -1);
+
+  int is_complete = 1;
+  unsigned channel;
+  const void *msg;
+  size_t msg_size;
+  ASSERT_EQ(msgstream_demux_incremental_recv(read_, demux_, &is_complete,
+                                             &channel, &msg, &msg_size),
+            MSGSTREAM_OK);
+  EXPECT_FALSE(is_complete);
+
+  std::vector<uint8_t> big(1000);
+  for (size_t i = 0; i < big.size(); ++i)
+    big[i] = i % 251;
+
+  ASSERT_EQ(msgstream_mux_send(mux_, 0, big.data(), big.size()),
+            MSGSTREAM_OK);
+  ASSERT_EQ(msgstream_mux_flush(mux_), MSGSTREAM_OK);
+
+  int ncalls = 0;
+  while (!is_complete && ncalls++ < 100)
+    ASSERT_EQ(msgstream_demux_incremental_recv(read_, demux_, &is_complete,
+                                               &channel, &msg, &msg_size),
+              MSGSTREAM_OK);
+
+  ASSERT_TRUE(is_complete);
+  EXPECT_EQ(channel, 0);
+
+  const uint8_t *bytes = (const uint8_t *)msg;
+  EXPECT_EQ(std::vector<uint8_t>(bytes, bytes + msg_size), big);
+}
+
+TEST_F(mux, IncrementalRecvReturnsBufferedMessagesFirst) {
+  ASSERT_EQ(msgstream_mux_send(mux_, 0, "hello", 5), MSGSTREAM_OK);
+  ASSERT_EQ(msgstream_mux_send(mux_, 1, "world", 5), MSGSTREAM_OK);
+  ASSERT_EQ(msgstream_mux_flush(mux_), MSGSTREAM_OK);
+
+  // both messages are read at once, so the second comes from the buffer
+  // rather than hitting end of file
+  close(write_);
+  write_ = -1;
+
+  int is_complete;
+  unsigned channel;
+  const void *msg;
+  size_t msg_size;
+  ASSERT_EQ(msgstream_demux_incremental_recv(read_, demux_, &is_complete,
+                                             &channel, &msg, &msg_size),
+            MSGSTREAM_OK);
+  ASSERT_TRUE(is_complete);
+  EXPECT_EQ((std::string_view{(const char *)msg, msg_size}), "hello");
+
+  ASSERT_EQ(msgstream_demux_incremental_recv(read_, demux_, &is_complete,
+                                             &channel, &msg, &msg_size),
+            MSGSTREAM_OK);
+  ASSERT_TRUE(is_complete);
+  EXPECT_EQ(channel, 1);
+  EXPECT_EQ((std::string_view{(const char *)msg, msg_size}), "world");
+
+  EXPECT_EQ(msgstream_demux_incremental_recv(read_, demux_, &is_complete,
+                                             &channel, &msg, &msg_size),
+            MSGSTREAM_EOF);
+}
+
+TEST_F(mux, ResumesPartialChunksOnNonBlockingFd) {
+  ASSERT_FALSE(fcntl(write_, F_SETFL, O_NONBLOCK) == -1);
+  ASSERT_FALSE(fcntl(read_, F_SETFL, O_NONBLOCK) == -1);
+
+  // chunks bigger than PIPE_BUF so a full pipe takes only part of one
+  auto mux = msgstream_mux_alloc(write_, 2, 10000);
+  ASSERT_TRUE(mux);
+
+  std::vector<uint8_t> a(300000), b(200000);
+  for (size_t i = 0; i < a.size(); ++i)
+    a[i] = i % 251;
+  for (size_t i = 0; i < b.size(); ++i)
+    b[i] = i % 241;
+
+  ASSERT_EQ(msgstream_mux_send(mux, 0, a.data(), a.size()), MSGSTREAM_OK);
+  ASSERT_EQ(msgstream_mux_send(mux, 1, b.data(), b.size()), MSGSTREAM_OK);
+
+  // collect what the pipe takes, draining a little whenever it fills up
+  FILE *wire = tmpfile();
+  ASSERT_TRUE(wire);
+
+  int is_idle = 0, would_block, nblocked = 0;
+  std::vector<uint8_t> drain(3000);
+  while (!is_idle) {
+    ASSERT_EQ(msgstream_mux_write_chunk(mux, &is_idle, &would_block),
+              MSGSTREAM_OK);
+    if (!would_block)
+      continue;
+
+    ++nblocked;
+    ssize_t n = read(read_, drain.data(), drain.size());
+    ASSERT_GT(n, 0);
+    ASSERT_EQ(fwrite(drain.data(), 1, n, wire), (size_t)n);
+  }
+
+  ssize_t n;
+  while ((n = read(read_, drain.data(), drain.size())) > 0)
+    ASSERT_EQ(fwrite(drain.data(), 1, n, wire), (size_t)n);
+
+  EXPECT_GT(nblocked, 0);
+  fflush(wire);
+  rewind(wire);
+
+  auto demux = msgstream_demux_alloc(2, a.size());
+  ASSERT_TRUE(demux);
+
+  unsigned channel;
+  const void *msg;
+  size_t msg_size;
+  for (int i = 0; i < 2; ++i) {
+    ASSERT_EQ(msgstream_demux_recv(fileno(wire), demux, &channel, &msg,
+                                   &msg_size),
+              MSGSTREAM_OK);
+
+    const auto &expect = channel == 0 ? a : b;
+    ASSERT_EQ(msg_size, expect.size());
+    EXPECT_EQ(memcmp(msg, expect.data(), msg_size), 0);
+  }
+
+  msgstream_demux_free(demux);
+  msgstream_mux_free(mux);
+  fclose(wire);
+}
+
+TEST_F(mux, ReassemblesChunksBiggerThanReadBuffer) {
+  FILE *wire = tmpfile();
+  ASSERT_TRUE(wire);
+
+  auto mux = msgstream_mux_alloc(fileno(wire), 2, 1 << 20);
+  ASSERT_TRUE(mux);
+
+  std::vector<uint8_t> big(300000);
+  for (size_t i = 0; i < big.size(); ++i)
+    big[i] = i % 251;
+
+  ASSERT_EQ(msgstream_mux_send(mux, 0, big.data(), big.size()), MSGSTREAM_OK);
+  ASSERT_EQ(msgstream_mux_send(mux, 1, "after", 5), MSGSTREAM_OK);
+  ASSERT_EQ(msgstream_mux_flush(mux), MSGSTREAM_OK);
+  msgstream_mux_free(mux);
+  rewind(wire);
+
+  auto demux = msgstream_demux_alloc(2, big.size());
+  ASSERT_TRUE(demux);
+
+  unsigned channel;
+  const void *msg;
+  size_t msg_size;
+  ASSERT_EQ(msgstream_demux_recv(fileno(wire), demux, &channel, &msg,
+                                 &msg_size),
+            MSGSTREAM_OK);
+  EXPECT_EQ(channel, 0);
+  ASSERT_EQ(msg_size, big.size());
+  EXPECT_EQ(memcmp(msg, big.data(), msg_size), 0);
+
+  ASSERT_EQ(msgstream_demux_recv(fileno(wire), demux, &channel, &msg,
+                                 &msg_size),
+            MSGSTREAM_OK);
+  EXPECT_EQ(channel, 1);
+  EXPECT_EQ((std::string_view{(const char *)msg, msg_size}), "after");
+
+  EXPECT_EQ(msgstream_demux_recv(fileno(wire), demux, &channel, &msg,
+                                 &msg_size),
+            MSGSTREAM_EOF);
+
+  msgstream_demux_free(demux);
+  fclose(wire);
+}
+
+TEST_F(mux, QueuesFromOtherThreadWhileFlushBlocks) {
+  auto mux = msgstream_mux_alloc(write_, 2, 4096);
+  ASSERT_TRUE(mux);
+
+  auto demux = msgstream_demux_alloc(2, 1 << 20);
+  ASSERT_TRUE(demux);
+
+  std::vector<uint8_t> bulk(1 << 20, 'b');
+  ASSERT_EQ(msgstream_mux_send(mux, 0, bulk.data(), bulk.size()),
+            MSGSTREAM_OK);
+
+  // the pipe fills long before the bulk message is written
+  int flush_ec = MSGSTREAM_EOF;
+  std::thread writer{[&] { flush_ec = msgstream_mux_flush(mux); }};
+
+  // no ASSERTs until the writer is joined
+  EXPECT_EQ(msgstream_mux_send(mux, 1, "control", 7), MSGSTREAM_OK);
+
+  unsigned channel;
+  const void *msg;
+  size_t msg_size;
+  int ec = msgstream_demux_recv(read_, demux, &channel, &msg, &msg_size);
+  EXPECT_EQ(ec, MSGSTREAM_OK);
+  if (ec == MSGSTREAM_OK) {
+    EXPECT_EQ(channel, 1);
+    EXPECT_EQ((std::string_view{(const char *)msg, msg_size}), "control");
+  }
+
+  ec = msgstream_demux_recv(read_, demux, &channel, &msg, &msg_size);
+  EXPECT_EQ(ec, MSGSTREAM_OK);
+  if (ec == MSGSTREAM_OK) {
+    EXPECT_EQ(channel, 0);
+    EXPECT_EQ(msg_size, bulk.size());
+  }
+
+  writer.join();
+  EXPECT_EQ(flush_ec, MSGSTREAM_OK);
+
+  msgstream_demux_free(demux);
+  msgstream_mux_free(mux);
+}
@@ -0,0 +1,240 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#include <gtest/gtest.h>
+
+#include "msgstream/pool.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string_view>
+#include <vector>
+
+class pool : public testing::Test {
+protected:
+  void SetUp() override {
+    int fds[2];
+    if (pipe(fds) == -1) {
+      perror("pipe");
+      ADD_FAILURE() << "Failed to allocate pipe";
+    }
+
+    read_ = fds[0];
+    write_ = fds[1];
+
+    pool_ = msgstream_reader_pool_alloc(buf_size_);
+    ASSERT_TRUE(pool_);
+  }
+
+  void TearDown() override {
+    msgstream_reader_pool_free(pool_);
+    close(read_);
+    close(write_);
+  }
+
+  int recv_all(struct msgstream_pooled_reader *reader, void **msg,
+               size_t *msg_size) {
+    int is_complete = 0, ec = MSGSTREAM_OK;
+    while (!ec && !is_complete)
+      ec = msgstream_fd_pooled_recv(read_, reader, &is_complete, msg, msg_size);
+
+    return ec;
+  }
+
+  static constexpr size_t buf_size_ = 4096;
+  msgstream_reader_pool pool_;
+  int read_;
+  int write_;
+};
+
+TEST_F(pool, NoBufferBorrowedUntilHeaderDecoded) {
+  auto reader = msgstream_pooled_reader_alloc(pool_);
+  ASSERT_TRUE(reader);
+
+  ASSERT_FALSE(fcntl(read_, F_SETFL, O_NONBLOCK) == -1);
+
+  int is_complete;
+  void *msg;
+  size_t msg_size;
+  int ec =
+      msgstream_fd_pooled_recv(read_, reader, &is_complete, &msg, &msg_size);
+  EXPECT_EQ(ec, MSGSTREAM_OK);
+  EXPECT_FALSE(is_complete);
+  EXPECT_EQ(msgstream_reader_pool_buffers_in_use(pool_), 0);
+
+  msgstream_pooled_reader_free(reader);
+}
+
+TEST_F(pool, ReceivesMessageAndReturnsBufferOnRelease) {
+  auto reader = msgstream_pooled_reader_alloc(pool_);
+  ASSERT_TRUE(reader);
+
+  char hello[] = "hello";
+  ASSERT_FALSE(msgstream_fd_send(write_, hello, buf_size_, sizeof(hello)));
+
+  void *msg;
+  size_t msg_size;
+  ASSERT_EQ(recv_all(reader, &msg, &msg_size), MSGSTREAM_OK);
+  EXPECT_EQ(msg_size, sizeof(hello));
+  EXPECT_EQ(std::string_view{(const char *)msg}, "hello");
+  EXPECT_EQ(msgstream_reader_pool_buffers_in_use(pool_), 1);
+
+  msgstream_pooled_reader_release(reader);
+  EXPECT_EQ(msgstream_reader_pool_buffers_in_use(pool_), 0);
+
+  msgstream_pooled_reader_free(reader);
+}
+
+TEST_F(pool, NextRecvReturnsPreviousBuffer) {
+  auto reader = msgstream_pooled_reader_alloc(pool_);
+  ASSERT_TRUE(reader);
+
+  char hello[] = "hello", goodbye[] = "goodbye";
+  ASSERT_FALSE(msgstream_fd_send(write_, hello, buf_size_, sizeof(hello)));
+  ASSERT_FALSE(msgstream_fd_send(write_, goodbye, buf_size_, sizeof(goodbye)));
+
+  void *msg;
+  size_t msg_size;
+  ASSERT_EQ(recv_all(reader, &msg, &msg_size), MSGSTREAM_OK);
+  EXPECT_EQ(std::string_view{(const char *)msg}, "hello");
+
+  ASSERT_EQ(recv_all(reader, &msg, &msg_size), MSGSTREAM_OK);
+  EXPECT_EQ(std::string_view{(const char *)msg}, "goodbye");
+  EXPECT_EQ(msgstream_reader_pool_buffers_in_use(pool_), 1);
+
+  msgstream_pooled_reader_free(reader);
+  EXPECT_EQ(msgstream_reader_pool_buffers_in_use(pool_), 0);
+}
+
+TEST_F(pool, EmptyMessageBorrowsNothing) {
+  auto reader = msgstream_pooled_reader_alloc(pool_);
+  ASSERT_TRUE(reader);
+
+  ASSERT_FALSE(msgstream_fd_send(write_, "", buf_size_, 0));
+
+  void *msg = &msg;
+  size_t msg_size = 1;
+  ASSERT_EQ(recv_all(reader, &msg, &msg_size), MSGSTREAM_OK);
+  EXPECT_EQ(msg_size, 0);
+  EXPECT_EQ(msg, nullptr);
+  EXPECT_EQ(msgstream_reader_pool_buffers_in_use(pool_), 0);
+
+  msgstream_pooled_reader_free(reader);
+}
+
+TEST_F(pool, EmbeddedReaderNeedsNoAllocation) {
+  struct {
+    int id;
+    struct msgstream_pooled_reader reader;
+  } conn;
+
+  ASSERT_EQ(msgstream_pooled_reader_init(&conn.reader, pool_), MSGSTREAM_OK);
+
+  char hello[] = "hello";
+  ASSERT_FALSE(msgstream_fd_send(write_, hello, buf_size_, sizeof(hello)));
+
+  void *msg;
+  size_t msg_size;
+  ASSERT_EQ(recv_all(&conn.reader, &msg, &msg_size), MSGSTREAM_OK);
+  EXPECT_EQ(std::string_view{(const char *)msg}, "hello");
+
+  msgstream_pooled_reader_cleanup(&conn.reader);
+  EXPECT_EQ(msgstream_reader_pool_buffers_in_use(pool_), 0);
+}
+
+TEST_F(pool, ManyReadersShareSlab) {
+  constexpr size_t n = 200;
+  struct msgstream_pooled_reader *readers[n];
+  for (size_t i = 0; i < n; ++i) {
+    readers[i] = msgstream_pooled_reader_alloc(pool_);
+    ASSERT_TRUE(readers[i]);
+  }
+
+  for (size_t i = 0; i < n; ++i)
+    msgstream_pooled_reader_free(readers[i]);
+}
+
+TEST_F(pool, VarintKeepsPayloadReadWithHeader) {
+  auto p = msgstream_varint_reader_pool_alloc(4096);
+  ASSERT_TRUE(p);
+
+  struct msgstream_pooled_reader reader;
+  ASSERT_EQ(msgstream_pooled_reader_init(&reader, p), MSGSTREAM_OK);
+
+  std::vector<uint8_t> big(300);
+  for (size_t i = 0; i < big.size(); ++i)
+    big[i] = i % 251;
+
+  ASSERT_FALSE(msgstream_fd_varint_send(write_, big.data(), big.size()));
+
+  int is_complete = 0, ec = MSGSTREAM_OK;
+  void *msg;
+  size_t msg_size;
+  while (!ec && !is_complete)
+    ec = msgstream_fd_pooled_recv(read_, &reader, &is_complete, &msg,
+                                  &msg_size);
+
+  EXPECT_EQ(ec, MSGSTREAM_OK);
+  if (is_complete) {
+    const uint8_t *bytes = (const uint8_t *)msg;
+    EXPECT_EQ(std::vector<uint8_t>(bytes, bytes + msg_size), big);
+  }
+
+  msgstream_pooled_reader_cleanup(&reader);
+  msgstream_reader_pool_free(p);
+}
+
+TEST_F(pool, VarintMessageBiggerThanPoolLimitIsRejected) {
+  auto p = msgstream_varint_reader_pool_alloc(4);
+  ASSERT_TRUE(p);
+
+  struct msgstream_pooled_reader reader;
+  ASSERT_EQ(msgstream_pooled_reader_init(&reader, p), MSGSTREAM_OK);
+
+  ASSERT_FALSE(msgstream_fd_varint_send(write_, "hello", 5));
+
+  int is_complete;
+  void *msg;
+  size_t msg_size;
+  int ec =
+      msgstream_fd_pooled_recv(read_, &reader, &is_complete, &msg, &msg_size);
+  EXPECT_EQ(ec, MSGSTREAM_BIG_MSG);
+  EXPECT_EQ(msgstream_reader_pool_buffers_in_use(p), 0);
+
+  msgstream_pooled_reader_cleanup(&reader);
+  msgstream_reader_pool_free(p);
+}
+
+TEST_F(pool, HugeVarintMessageIsRejectedBeforeAllocating) {
+  auto p = msgstream_varint_reader_pool_alloc(1 << 20);
+  ASSERT_TRUE(p);
+  auto reader = msgstream_pooled_reader_alloc(p);
+  ASSERT_TRUE(reader);
+
+  // bigger than the largest power of two size class
+  uint8_t hdr_buf[MSGSTREAM_VARINT_HEADER_BUF_SIZE];
+  size_t hdr_size;
+  ASSERT_EQ(msgstream_varint_encode_header(SIZE_MAX - 1, hdr_buf,
+                                           sizeof(hdr_buf), &hdr_size),
+            MSGSTREAM_OK);
+  ASSERT_EQ(write(write_, hdr_buf, hdr_size), (ssize_t)hdr_size);
+
+  int is_complete = 0, ec = MSGSTREAM_OK;
+  void *msg;
+  size_t msg_size;
+  while (!ec && !is_complete)
+    ec = msgstream_fd_pooled_recv(read_, reader, &is_complete, &msg,
+                                  &msg_size);
+
+  EXPECT_EQ(ec, MSGSTREAM_BIG_MSG);
+  EXPECT_EQ(msgstream_reader_pool_buffers_in_use(p), 0);
+
+  msgstream_pooled_reader_free(reader);
+  msgstream_reader_pool_free(p);
+}
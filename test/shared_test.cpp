@@ -0,0 +1,350 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#include <gtest/gtest.h>
+
+#include "msgstream/shared.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+class shared : public testing::Test {
+protected:
+  void SetUp() override {
+    int fds[2];
+    if (pipe(fds) == -1) {
+      perror("pipe");
+      ADD_FAILURE() << "Failed to allocate pipe";
+    }
+
+    read_ = fds[0];
+    write_ = fds[1];
+  }
+
+  void TearDown() override {
+    close(read_);
+    if (write_ != -1)
+      close(write_);
+  }
+
+  void close_write() {
+    close(write_);
+    write_ = -1;
+  }
+
+  struct consumed {
+    std::vector<size_t> sizes;
+    int ntorn = 0;
+    int nbad_ec = 0;
+  };
+
+  // receive on several threads until end of file or an empty message
+  static consumed consume(msgstream_shared_reader reader, size_t buf_size,
+                          size_t nconsumers) {
+    std::mutex mtx;
+    consumed out;
+
+    std::vector<std::thread> consumers;
+    for (size_t c = 0; c < nconsumers; ++c) {
+      consumers.emplace_back([&] {
+        std::vector<uint8_t> buf(buf_size);
+        size_t msg_size;
+        int ec;
+        while ((ec = msgstream_shared_recv(reader, buf.data(), buf.size(),
+                                           &msg_size)) == MSGSTREAM_OK &&
+               msg_size > 0) {
+          bool torn = false;
+          for (size_t i = 1; i < msg_size; ++i)
+            torn = torn || buf[i] != buf[0];
+
+          std::lock_guard lk{mtx};
+          out.sizes.push_back(msg_size);
+          out.ntorn += torn;
+        }
+
+        std::lock_guard lk{mtx};
+        out.nbad_ec += ec != MSGSTREAM_EOF && ec != MSGSTREAM_OK;
+      });
+    }
+
+    for (auto &th : consumers)
+      th.join();
+
+    return out;
+  }
+
+  // every byte of message i is i, so torn reads are detectable
+  static void produce(int fd, size_t buf_size, size_t nmsgs, int varint) {
+    std::vector<uint8_t> msg(buf_size);
+    for (size_t i = 0; i < nmsgs; ++i) {
+      size_t size = 1 + (i * 37) % buf_size;
+      std::fill(msg.begin(), msg.begin() + size, i % 256);
+      if (varint)
+        msgstream_fd_varint_send(fd, msg.data(), size);
+      else
+        msgstream_fd_send(fd, msg.data(), buf_size, size);
+    }
+  }
+
+  // packets can't signal end of file, so stop each consumer with an empty
+  // message
+  static void stop(int fd, size_t buf_size, size_t nconsumers, int varint) {
+    for (size_t c = 0; c < nconsumers; ++c) {
+      if (varint)
+        msgstream_fd_varint_send(fd, "", 0);
+      else
+        msgstream_fd_send(fd, "", buf_size, 0);
+    }
+  }
+
+  int read_;
+  int write_;
+};
+
+TEST_F(shared, ConsumersEachReceiveWholeMessagesOnce) {
+  constexpr size_t buf_size = 1024, nmsgs = 2000, nconsumers = 4;
+
+  auto reader = msgstream_shared_reader_alloc(read_, buf_size);
+  ASSERT_TRUE(reader);
+
+  std::thread producer{[&] {
+    produce(write_, buf_size, nmsgs, 0);
+    close_write();
+  }};
+
+  auto out = consume(reader, buf_size, nconsumers);
+  producer.join();
+
+  EXPECT_EQ(out.sizes.size(), nmsgs);
+  EXPECT_EQ(out.ntorn, 0);
+  EXPECT_EQ(out.nbad_ec, 0);
+
+  msgstream_shared_reader_free(reader);
+}
+
+TEST_F(shared, PacketConsumersEachReceiveWholeMessagesOnce) {
+  constexpr size_t buf_size = 1024, nmsgs = 2000, nconsumers = 4;
+
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_DGRAM, 0, fds), 0);
+
+  auto reader = msgstream_shared_reader_alloc(fds[0], buf_size);
+  ASSERT_TRUE(reader);
+
+  std::thread producer{[&] {
+    produce(fds[1], buf_size, nmsgs, 0);
+    stop(fds[1], buf_size, nconsumers, 0);
+  }};
+
+  auto out = consume(reader, buf_size, nconsumers);
+  producer.join();
+
+  EXPECT_EQ(out.sizes.size(), nmsgs);
+  EXPECT_EQ(out.ntorn, 0);
+  EXPECT_EQ(out.nbad_ec, 0);
+
+  msgstream_shared_reader_free(reader);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+#ifdef O_DIRECT
+TEST_F(shared, PacketPipeConsumersReceiveVarintMessages) {
+  constexpr size_t buf_size = 1024, nmsgs = 2000, nconsumers = 4;
+
+  int fds[2];
+  ASSERT_EQ(pipe2(fds, O_DIRECT), 0);
+
+  auto reader = msgstream_varint_shared_reader_alloc(fds[0], buf_size);
+  ASSERT_TRUE(reader);
+  ASSERT_EQ(msgstream_shared_reader_set_packet(reader, 1), MSGSTREAM_OK);
+
+  std::thread producer{[&] {
+    produce(fds[1], buf_size, nmsgs, 1);
+    close(fds[1]);
+  }};
+
+  auto out = consume(reader, buf_size, nconsumers);
+  producer.join();
+
+  EXPECT_EQ(out.sizes.size(), nmsgs);
+  EXPECT_EQ(out.ntorn, 0);
+  EXPECT_EQ(out.nbad_ec, 0);
+
+  msgstream_shared_reader_free(reader);
+  close(fds[0]);
+}
+#endif
+
+TEST_F(shared, PacketTooBigForBufferIsDropped) {
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_DGRAM, 0, fds), 0);
+
+  auto reader = msgstream_varint_shared_reader_alloc(fds[0], 64);
+  ASSERT_TRUE(reader);
+
+  ASSERT_FALSE(msgstream_fd_varint_send(fds[1], "hello", 5));
+  ASSERT_FALSE(msgstream_fd_varint_send(fds[1], "bye", 3));
+
+  char buf[4];
+  size_t msg_size;
+  EXPECT_EQ(msgstream_shared_recv(reader, buf, sizeof(buf), &msg_size),
+            MSGSTREAM_BIG_MSG);
+
+  ASSERT_EQ(msgstream_shared_recv(reader, buf, sizeof(buf), &msg_size),
+            MSGSTREAM_OK);
+  EXPECT_EQ((std::string_view{buf, msg_size}), "bye");
+
+  msgstream_shared_reader_free(reader);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+static std::atomic<int> nsignals;
+static void count_signal(int) { nsignals += 1; }
+
+TEST_F(shared, SignalDuringReadIsNotAnError) {
+  struct sigaction sa = {}, old_sa;
+  sa.sa_handler = count_signal;
+  ASSERT_EQ(sigaction(SIGUSR1, &sa, &old_sa), 0);
+
+  auto reader = msgstream_shared_reader_alloc(read_, 64);
+  ASSERT_TRUE(reader);
+
+  std::atomic<bool> receiving = false, done = false;
+  int ec = MSGSTREAM_EOF;
+  size_t msg_size = 0;
+  char buf[64];
+  std::thread consumer{[&] {
+    receiving = true;
+    ec = msgstream_shared_recv(reader, buf, sizeof(buf), &msg_size);
+    done = true;
+  }};
+
+  while (!receiving)
+    std::this_thread::yield();
+
+  // Without SA_RESTART, a blocked read() fails with EINTR. Nothing has been
+  // written, so the consumer can only be in read() once it has started
+  // receiving. Keep interrupting it until it has handled several signals.
+  nsignals = 0;
+  while (nsignals < 5 && !done) {
+    pthread_kill(consumer.native_handle(), SIGUSR1);
+    std::this_thread::yield();
+  }
+
+  EXPECT_FALSE(done);
+  EXPECT_FALSE(msgstream_fd_send(write_, "hello", 64, 5));
+
+  consumer.join();
+  sigaction(SIGUSR1, &old_sa, nullptr);
+
+  EXPECT_EQ(ec, MSGSTREAM_OK);
+  EXPECT_EQ((std::string_view{buf, msg_size}), "hello");
+
+  msgstream_shared_reader_free(reader);
+}
+
+TEST_F(shared, ConsumersReceiveMessagesBiggerThanReadBuffer) {
+  // big enough that some frames are read directly instead of buffered
+  constexpr size_t buf_size = 3 << 20, nconsumers = 3;
+  const std::vector<size_t> sizes = {5, buf_size, 100, 2 << 20, 7, buf_size};
+
+  auto reader = msgstream_shared_reader_alloc(read_, buf_size);
+  ASSERT_TRUE(reader);
+
+  std::thread producer{[&] {
+    std::vector<uint8_t> msg(buf_size);
+    for (size_t i = 0; i < sizes.size(); ++i) {
+      std::fill(msg.begin(), msg.begin() + sizes[i], i + 1);
+      msgstream_fd_send(write_, msg.data(), buf_size, sizes[i]);
+    }
+
+    close_write();
+  }};
+
+  auto out = consume(reader, buf_size, nconsumers);
+  producer.join();
+
+  std::sort(out.sizes.begin(), out.sizes.end());
+  auto expected = sizes;
+  std::sort(expected.begin(), expected.end());
+  EXPECT_EQ(out.sizes, expected);
+  EXPECT_EQ(out.ntorn, 0);
+  EXPECT_EQ(out.nbad_ec, 0);
+
+  msgstream_shared_reader_free(reader);
+}
+
+TEST_F(shared, BodyBiggerThanReadBufferAndBufferIsSkipped) {
+  constexpr size_t buf_size = 2 << 20;
+  auto reader = msgstream_shared_reader_alloc(read_, buf_size);
+  ASSERT_TRUE(reader);
+
+  std::thread producer{[&] {
+    std::vector<uint8_t> msg(buf_size, 1);
+    msgstream_fd_send(write_, msg.data(), buf_size, buf_size);
+    msgstream_fd_send(write_, "bye", buf_size, 3);
+  }};
+
+  char buf[4];
+  size_t msg_size;
+  EXPECT_EQ(msgstream_shared_recv(reader, buf, sizeof(buf), &msg_size),
+            MSGSTREAM_BIG_MSG);
+  EXPECT_EQ(msgstream_shared_recv(reader, buf, sizeof(buf), &msg_size),
+            MSGSTREAM_OK);
+  producer.join();
+
+  EXPECT_EQ((std::string_view{buf, msg_size}), "bye");
+
+  msgstream_shared_reader_free(reader);
+}
+
+TEST_F(shared, BodyTooBigForBufferIsSkipped) {
+  auto reader = msgstream_varint_shared_reader_alloc(read_, 64);
+  ASSERT_TRUE(reader);
+
+  ASSERT_FALSE(msgstream_fd_varint_send(write_, "hello", 5));
+  ASSERT_FALSE(msgstream_fd_varint_send(write_, "bye", 3));
+
+  char buf[4];
+  size_t msg_size;
+  EXPECT_EQ(msgstream_shared_recv(reader, buf, sizeof(buf), &msg_size),
+            MSGSTREAM_BIG_MSG);
+
+  ASSERT_EQ(msgstream_shared_recv(reader, buf, sizeof(buf), &msg_size),
+            MSGSTREAM_OK);
+  EXPECT_EQ((std::string_view{buf, msg_size}), "bye");
+
+  msgstream_shared_reader_free(reader);
+}
+
+TEST_F(shared, EofIsStickyForAllConsumers) {
+  auto reader = msgstream_shared_reader_alloc(read_, 64);
+  ASSERT_TRUE(reader);
+
+  close_write();
+
+  char buf[64];
+  size_t msg_size;
+  EXPECT_EQ(msgstream_shared_recv(reader, buf, sizeof(buf), &msg_size),
+            MSGSTREAM_EOF);
+  EXPECT_EQ(msgstream_shared_recv(reader, buf, sizeof(buf), &msg_size),
+            MSGSTREAM_EOF);
+
+  msgstream_shared_reader_free(reader);
+}
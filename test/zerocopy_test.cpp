@@ -0,0 +1,172 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#include <gtest/gtest.h>
+
+#include "msgstream/zerocopy.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <thread>
+#include <vector>
+
+class zerocopy : public testing::Test {
+protected:
+  void SetUp() override {
+    int lsock = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_NE(lsock, -1);
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+
+    socklen_t len = sizeof(addr);
+    ASSERT_EQ(bind(lsock, (struct sockaddr *)&addr, len), 0);
+    ASSERT_EQ(listen(lsock, 1), 0);
+    ASSERT_EQ(getsockname(lsock, (struct sockaddr *)&addr, &len), 0);
+
+    send_ = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_EQ(connect(send_, (struct sockaddr *)&addr, len), 0);
+
+    recv_ = accept(lsock, nullptr, nullptr);
+    ASSERT_NE(recv_, -1);
+    close(lsock);
+  }
+
+  void TearDown() override {
+    close(send_);
+    close(recv_);
+  }
+
+  int send_ = -1;
+  int recv_ = -1;
+};
+
+TEST_F(zerocopy, LargeMessageArrivesAndCompletes) {
+  constexpr size_t size = 1 << 20;
+  std::vector<uint8_t> msg(size), recv(size);
+  for (size_t i = 0; i < size; ++i)
+    msg[i] = i % 253;
+
+  auto zc = msgstream_zerocopy_alloc(send_, 4096);
+  ASSERT_TRUE(zc);
+
+#ifdef __linux__
+  EXPECT_TRUE(msgstream_zerocopy_enabled(zc));
+#endif
+
+  int sret = MSGSTREAM_EOF;
+  std::thread th{[&] {
+    uint64_t ticket;
+    sret = msgstream_zerocopy_send(zc, msg.data(), size, size, &ticket);
+    if (sret == MSGSTREAM_OK)
+      sret = msgstream_zerocopy_wait(zc, ticket);
+  }};
+
+  size_t msg_size;
+  auto rret = msgstream_fd_recv(recv_, recv.data(), size, &msg_size);
+  th.join();
+
+  EXPECT_EQ(rret, MSGSTREAM_OK);
+  EXPECT_EQ(sret, MSGSTREAM_OK);
+  EXPECT_EQ(msg_size, size);
+  EXPECT_EQ(recv, msg);
+
+  msgstream_zerocopy_free(zc);
+}
+
+TEST_F(zerocopy, SmallMessageIsDoneImmediately) {
+  auto zc = msgstream_zerocopy_alloc(send_, 4096);
+  ASSERT_TRUE(zc);
+
+  uint64_t ticket;
+  ASSERT_EQ(msgstream_zerocopy_send(zc, "hello", 64, 5, &ticket),
+            MSGSTREAM_OK);
+
+  int is_done = 0;
+  ASSERT_EQ(msgstream_zerocopy_done(zc, ticket, &is_done), MSGSTREAM_OK);
+  EXPECT_TRUE(is_done);
+
+  char buf[64];
+  size_t msg_size;
+  ASSERT_EQ(msgstream_fd_recv(recv_, buf, sizeof(buf), &msg_size),
+            MSGSTREAM_OK);
+  EXPECT_EQ((std::string_view{buf, msg_size}), "hello");
+
+  msgstream_zerocopy_free(zc);
+}
+
+TEST_F(zerocopy, SecondSenderOnSocketCopies) {
+  constexpr size_t size = 1 << 16;
+  std::vector<uint8_t> msg(size, 7), recv(size);
+
+  int rret = MSGSTREAM_EOF;
+  std::thread th{[&] {
+    size_t msg_size;
+    rret = msgstream_fd_recv(recv_, recv.data(), size, &msg_size);
+    if (rret == MSGSTREAM_OK)
+      rret = msgstream_fd_recv(recv_, recv.data(), size, &msg_size);
+  }};
+
+  // the first sender used up the socket's send ids, so a second sender
+  // can't tell which completions are its own
+  int enabled[2] = {};
+  int sret[2] = {MSGSTREAM_EOF, MSGSTREAM_EOF};
+  for (int i = 0; i < 2; ++i) {
+    auto zc = msgstream_zerocopy_alloc(send_, 0);
+    if (!zc)
+      break;
+
+    enabled[i] = msgstream_zerocopy_enabled(zc);
+
+    uint64_t ticket;
+    sret[i] = msgstream_zerocopy_send(zc, msg.data(), size, size, &ticket);
+    if (sret[i] == MSGSTREAM_OK)
+      sret[i] = msgstream_zerocopy_wait(zc, ticket);
+
+    msgstream_zerocopy_free(zc);
+  }
+
+  th.join();
+
+#ifdef __linux__
+  EXPECT_TRUE(enabled[0]);
+#endif
+  EXPECT_FALSE(enabled[1]);
+  EXPECT_EQ(sret[0], MSGSTREAM_OK);
+  EXPECT_EQ(sret[1], MSGSTREAM_OK);
+  EXPECT_EQ(rret, MSGSTREAM_OK);
+  EXPECT_EQ(recv, msg);
+}
+
+TEST(ZeroCopyUnsupported, FallsBackToCopyingOnUnixSockets) {
+  int sv[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+
+  auto zc = msgstream_zerocopy_alloc(sv[0], 0);
+  ASSERT_TRUE(zc);
+  EXPECT_FALSE(msgstream_zerocopy_enabled(zc));
+
+  uint64_t ticket;
+  ASSERT_EQ(msgstream_zerocopy_send(zc, "hello", 64, 5, &ticket),
+            MSGSTREAM_OK);
+  EXPECT_EQ(msgstream_zerocopy_wait(zc, ticket), MSGSTREAM_OK);
+
+  char buf[64];
+  size_t msg_size;
+  ASSERT_EQ(msgstream_fd_recv(sv[1], buf, sizeof(buf), &msg_size),
+            MSGSTREAM_OK);
+  EXPECT_EQ((std::string_view{buf, msg_size}), "hello");
+
+  msgstream_zerocopy_free(zc);
+  close(sv[0]);
+  close(sv[1]);
+}
@@ -0,0 +1,95 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#define _GNU_SOURCE // getopt
+#include "msgstream/capture.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/*
+ * Re-send the messages in a capture with msgstream_capture_replay.
+ *
+ *   msgstream_replay [-s speed] [-f src_fd] [-b buf_size] capture [out]
+ *
+ * Messages are sent to out, which is created or truncated, or to stdout.
+ * speed scales the captured pacing and defaults to 1. 0 sends as fast as
+ * possible. src_fd replays only messages captured from that fd. buf_size is
+ * the buffer size to frame messages with and defaults to 65536.
+ */
+
+#define DEFAULT_BUF_SIZE 65536
+
+static int usage(const char *argv0) {
+  fprintf(stderr,
+          "usage: %s [-s speed] [-f src_fd] [-b buf_size] capture [out]\n",
+          argv0);
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  double speed = 1;
+  int src_fd = -1;
+  size_t buf_size = DEFAULT_BUF_SIZE;
+
+  int opt;
+  char *end;
+  while ((opt = getopt(argc, argv, "s:f:b:")) != -1) {
+    switch (opt) {
+    case 's':
+      speed = strtod(optarg, &end);
+      if (*end || speed < 0)
+        return usage(argv[0]);
+      break;
+    case 'f':
+      src_fd = (int)strtol(optarg, &end, 10);
+      if (*end || src_fd < 0)
+        return usage(argv[0]);
+      break;
+    case 'b':
+      buf_size = strtoul(optarg, &end, 10);
+      if (*end)
+        return usage(argv[0]);
+      break;
+    default:
+      return usage(argv[0]);
+    }
+  }
+
+  int nargs = argc - optind;
+  if (nargs < 1 || nargs > 2)
+    return usage(argv[0]);
+
+  int capture_fd = open(argv[optind], O_RDONLY);
+  if (capture_fd == -1) {
+    perror(argv[optind]);
+    return 1;
+  }
+
+  int out_fd = STDOUT_FILENO;
+  if (nargs == 2) {
+    out_fd = open(argv[optind + 1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out_fd == -1) {
+      perror(argv[optind + 1]);
+      close(capture_fd);
+      return 1;
+    }
+  }
+
+  int ec = msgstream_capture_replay(capture_fd, src_fd, out_fd, buf_size,
+                                    speed);
+  if (ec)
+    fprintf(stderr, "%s: %s\n", argv[optind], msgstream_errstr(ec));
+
+  if (out_fd != STDOUT_FILENO)
+    close(out_fd);
+
+  close(capture_fd);
+  return ec ? 1 : 0;
+}